@@ -0,0 +1,283 @@
+// Scaling benchmark over synthetic cities. Generates a network with
+// GenerateCity, runs the whole pipeline on it and prints the time of every
+// phase as JSON, so results of different revisions can be compared by a script.
+//
+// Build from the repository root:
+//   g++ -std=c++17 -O2 -pthread -Iinc -Ibench bench/bench.cpp bench/city_generator.cpp
+//       $(ls src/*.cpp | grep -v main.cpp) -o transport_bench
+//
+// Options, all optional:
+//   --stops N --buses N --min-route-length N --max-route-length N
+//   --roundtrip-ratio X --queries N --query-mix BUS:STOP:ROUTE --seed N
+//   --router floyd_warshall|dijkstra --graph-model stop_to_stop|transit
+//   --threads N --repeat N --write-input FILE
+#include "city_generator.h"
+#include "Requests.h"
+#include "json.h"
+
+#include <algorithm>
+#include <chrono>
+#include <cstdlib>
+#include <fstream>
+#include <iostream>
+#include <map>
+#include <sstream>
+#include <string>
+#include <vector>
+
+using namespace std;
+
+namespace {
+
+using Clock = chrono::steady_clock;
+
+double MillisecondsSince(Clock::time_point start) {
+  return chrono::duration<double, milli>(Clock::now() - start).count();
+}
+
+struct BenchOptions {
+  CityParams city;
+  RouterType router_type = RouterType::FLOYD_WARSHALL;
+  GraphModel graph_model = GraphModel::STOP_TO_STOP;
+  size_t thread_count = 1;
+  int repeat = 3;
+  string input_file;
+};
+
+[[noreturn]] void Usage(const string& message) {
+  cerr << "transport_bench: " << message << endl;
+  exit(1);
+}
+
+BenchOptions ParseOptions(int argc, const char* argv[]) {
+  BenchOptions options;
+  for(int idx = 1; idx < argc; idx += 2) {
+    const string_view name = argv[idx];
+    if(idx + 1 == argc) {
+      Usage("missing value of " + string(name));
+    }
+    const string value = argv[idx + 1];
+    CityParams& city = options.city;
+    if(name == "--stops") {
+      city.stop_count = stoi(value);
+    } else if(name == "--buses") {
+      city.bus_count = stoi(value);
+    } else if(name == "--min-route-length") {
+      city.min_route_length = stoi(value);
+    } else if(name == "--max-route-length") {
+      city.max_route_length = stoi(value);
+    } else if(name == "--roundtrip-ratio") {
+      city.roundtrip_ratio = stod(value);
+    } else if(name == "--queries") {
+      city.query_count = stoi(value);
+    } else if(name == "--query-mix") {
+      char separator;
+      istringstream mix(value);
+      if(!(mix >> city.bus_query_weight >> separator >> city.stop_query_weight
+          >> separator >> city.route_query_weight)) {
+        Usage("--query-mix expects BUS:STOP:ROUTE weights");
+      }
+    } else if(name == "--seed") {
+      city.seed = stoull(value);
+    } else if(name == "--router") {
+      options.router_type = ROUTER_TYPE.at(value);
+    } else if(name == "--graph-model") {
+      options.graph_model = GRAPH_MODEL.at(value);
+    } else if(name == "--threads") {
+      options.thread_count = stoul(value);
+    } else if(name == "--repeat") {
+      options.repeat = stoi(value);
+    } else if(name == "--write-input") {
+      options.input_file = value;
+    } else {
+      Usage("unknown option " + string(name));
+    }
+  }
+  if(options.city.stop_count < 2 || options.city.min_route_length < 2 || options.repeat < 1) {
+    Usage("need at least 2 stops, routes of at least 2 stops and one repetition");
+  }
+  return options;
+}
+
+struct PhaseTimes {
+  vector<double> samples;
+
+  double Min() const {
+    return *min_element(begin(samples), end(samples));
+  }
+  double Mean() const {
+    double sum = 0;
+    for(double sample: samples) {
+      sum += sample;
+    }
+    return sum / samples.size();
+  }
+};
+
+struct RequestTimes {
+  int count = 0;
+  PhaseTimes totals;
+  double max_ms = 0;
+};
+
+const char* REQUEST_TYPE_NAMES[] = {"Stop", "Bus", "Route"};
+
+// One pass over the generated document, timed phase by phase. Stat requests are
+// answered one by one on this thread so that per-type times are not blurred by
+// the thread pool.
+void RunPipeline(const BenchOptions& options, string_view input,
+    map<string, PhaseTimes>& phases, map<string, RequestTimes>& requests) {
+  Clock::time_point start = Clock::now();
+  JsonParser jp;
+  JsonParser::InputSections sections = jp.SplitInput(input);
+  RoutingSettings settings = jp.GetRoutingSettings(sections.routing_settings.GetRoot());
+  const BaseRequests base_requests = jp.ReadBaseRequests(sections.base_requests);
+  StatRequestStream stat_stream(sections.stat_requests);
+  vector<StatRequest> stat_requests;
+  while(!stat_stream.AtEnd()) {
+    for(StatRequest& request: stat_stream.ReadBatch(1024)) {
+      stat_requests.push_back(move(request));
+    }
+  }
+  phases["json_parse"].samples.push_back(MillisecondsSince(start));
+
+  settings.router_type = options.router_type;
+  settings.graph_model = options.graph_model;
+  settings.thread_count = options.thread_count;
+  RouteManager rm(settings);
+  Visitor visitor;
+  visitor.SetRouteManager(&rm);
+
+  // The same two passes as ModifyProcessing, timed separately: stops only store
+  // their data, buses compute their stats and expand the graph.
+  start = Clock::now();
+  for(const ModifyStopRequest& request: base_requests.stops) {
+    visitor.Visit(request);
+  }
+  phases["modify_stops"].samples.push_back(MillisecondsSince(start));
+
+  start = Clock::now();
+  for(const ModifyBusRequest& request: base_requests.buses) {
+    visitor.Visit(request);
+  }
+  phases["graph_build"].samples.push_back(MillisecondsSince(start));
+
+  start = Clock::now();
+  rm.BuildRouterIfNotExists();
+  phases["router_build"].samples.push_back(MillisecondsSince(start));
+
+  map<string, double> totals;
+  map<string, int> counts;
+  start = Clock::now();
+  for(const StatRequest& request: stat_requests) {
+    const string type_name = REQUEST_TYPE_NAMES[request.index()];
+    const Clock::time_point request_start = Clock::now();
+    visitor.Visit(request);
+    const double elapsed = MillisecondsSince(request_start);
+    totals[type_name] += elapsed;
+    ++counts[type_name];
+    requests[type_name].max_ms = max(requests[type_name].max_ms, elapsed);
+  }
+  phases["stat_requests"].samples.push_back(MillisecondsSince(start));
+  for(const auto& [type_name, total]: totals) {
+    requests[type_name].count = counts[type_name];
+    requests[type_name].totals.samples.push_back(total);
+  }
+}
+
+void WritePhase(Json::Writer& writer, const PhaseTimes& times) {
+  writer.BeginObject();
+  writer.Key("min_ms");
+  writer.Value(times.Min());
+  writer.Key("mean_ms");
+  writer.Value(times.Mean());
+  writer.EndObject();
+}
+
+}
+
+int main(int argc, const char* argv[]) {
+  const BenchOptions options = ParseOptions(argc, argv);
+
+  Clock::time_point start = Clock::now();
+  ostringstream generated;
+  GenerateCity(options.city, generated);
+  const string input = generated.str();
+  const double generate_ms = MillisecondsSince(start);
+  if(!options.input_file.empty()) {
+    ofstream(options.input_file) << input;
+  }
+
+  map<string, PhaseTimes> phases;
+  map<string, RequestTimes> requests;
+  for(int run = 0; run < options.repeat; ++run) {
+    RunPipeline(options, input, phases, requests);
+  }
+
+  cout.precision(6);
+  Json::Writer writer(cout);
+  writer.BeginObject();
+  writer.Key("params");
+  writer.BeginObject();
+  writer.Key("stops");
+  writer.Value(options.city.stop_count);
+  writer.Key("buses");
+  writer.Value(options.city.bus_count);
+  writer.Key("min_route_length");
+  writer.Value(options.city.min_route_length);
+  writer.Key("max_route_length");
+  writer.Value(options.city.max_route_length);
+  writer.Key("roundtrip_ratio");
+  writer.Value(options.city.roundtrip_ratio);
+  writer.Key("queries");
+  writer.Value(options.city.query_count);
+  writer.Key("query_mix");
+  writer.Value(to_string(options.city.bus_query_weight) + ":" +
+      to_string(options.city.stop_query_weight) + ":" + to_string(options.city.route_query_weight));
+  writer.Key("seed");
+  writer.Value(to_string(options.city.seed));
+  writer.Key("router");
+  writer.Value(options.router_type == RouterType::DIJKSTRA ? "dijkstra" : "floyd_warshall");
+  writer.Key("graph_model");
+  writer.Value(options.graph_model == GraphModel::TRANSIT ? "transit" : "stop_to_stop");
+  writer.Key("threads");
+  writer.Value(static_cast<int>(options.thread_count));
+  writer.Key("repeat");
+  writer.Value(options.repeat);
+  writer.Key("input_bytes");
+  writer.Value(static_cast<double>(input.size()));
+  writer.EndObject();
+
+  writer.Key("generate_ms");
+  writer.Value(generate_ms);
+  writer.Key("phases");
+  writer.BeginObject();
+  for(const char* phase: {"json_parse", "modify_stops", "graph_build", "router_build", "stat_requests"}) {
+    writer.Key(phase);
+    WritePhase(writer, phases[phase]);
+  }
+  writer.EndObject();
+
+  writer.Key("requests");
+  writer.BeginObject();
+  for(const auto& [type_name, times]: requests) {
+    writer.Key(type_name);
+    writer.BeginObject();
+    writer.Key("count");
+    writer.Value(times.count);
+    writer.Key("min_total_ms");
+    writer.Value(times.totals.Min());
+    writer.Key("mean_total_ms");
+    writer.Value(times.totals.Mean());
+    writer.Key("mean_us");
+    writer.Value(times.totals.Mean() * 1000 / max(times.count, 1));
+    writer.Key("max_ms");
+    writer.Value(times.max_ms);
+    writer.EndObject();
+  }
+  writer.EndObject();
+  writer.EndObject();
+  writer.Flush();
+  cout << endl;
+  return 0;
+}
@@ -0,0 +1,191 @@
+#include "city_generator.h"
+#include "json.h"
+
+#include <algorithm>
+#include <cmath>
+#include <map>
+#include <random>
+#include <string>
+#include <vector>
+
+using namespace std;
+
+namespace {
+
+class CityRandom {
+public:
+  explicit CityRandom(uint64_t seed) : engine(seed) {}
+
+  // Uniform in [0, bound).
+  uint64_t Below(uint64_t bound) {
+    return engine() % bound;
+  }
+
+  // Uniform in [0, 1).
+  double Unit() {
+    return static_cast<double>(engine() >> 11) / static_cast<double>(1ull << 53);
+  }
+
+private:
+  mt19937_64 engine;
+};
+
+struct GeneratedStop {
+  string name;
+  double latitude;
+  double longitude;
+  map<int, int> distances;
+};
+
+const double PI = 3.1415926535;
+
+double ToRadians(double degrees) {
+  return degrees * PI / 180;
+}
+
+// The same great-circle formula Strategy::ComputeDistance uses.
+double StraightDistance(const GeneratedStop& lhs, const GeneratedStop& rhs) {
+  const double lhs_latitude = ToRadians(lhs.latitude);
+  const double rhs_latitude = ToRadians(rhs.latitude);
+  return acos(min(1.0, sin(lhs_latitude) * sin(rhs_latitude) +
+      cos(lhs_latitude) * cos(rhs_latitude) *
+      cos(abs(ToRadians(lhs.longitude) - ToRadians(rhs.longitude))))) * 6371000;
+}
+
+int RoadDistance(const GeneratedStop& lhs, const GeneratedStop& rhs, CityRandom& random) {
+  return max(1, static_cast<int>(ceil(StraightDistance(lhs, rhs) * (1.0 + 0.5 * random.Unit()))));
+}
+
+string BusName(size_t bus) {
+  return "Bus " + to_string(bus);
+}
+
+}
+
+void GenerateCity(const CityParams& params, ostream& output) {
+  CityRandom random(params.seed);
+
+  vector<GeneratedStop> stops(params.stop_count);
+  for(int idx = 0; idx < params.stop_count; ++idx) {
+    stops[idx].name = "Stop " + to_string(idx);
+    stops[idx].latitude = 55.65 + 0.18 * random.Unit();
+    stops[idx].longitude = 37.45 + 0.32 * random.Unit();
+  }
+
+  struct GeneratedBus {
+    vector<int> stops;
+    bool is_roundtrip;
+  };
+  vector<GeneratedBus> buses(params.bus_count);
+  const int max_length = min(params.max_route_length, params.stop_count);
+  const int min_length = min(params.min_route_length, max_length);
+  for(GeneratedBus& bus: buses) {
+    const int length = min_length + random.Below(max_length - min_length + 1);
+    // Partial Fisher-Yates over the stop ids gives distinct stops.
+    vector<int> candidates(params.stop_count);
+    for(int idx = 0; idx < params.stop_count; ++idx) {
+      candidates[idx] = idx;
+    }
+    for(int idx = 0; idx < length; ++idx) {
+      swap(candidates[idx], candidates[idx + random.Below(params.stop_count - idx)]);
+      bus.stops.push_back(candidates[idx]);
+    }
+    bus.is_roundtrip = random.Unit() < params.roundtrip_ratio;
+    if(bus.is_roundtrip) {
+      bus.stops.push_back(bus.stops.front());
+    }
+    for(size_t idx = 0; idx + 1 < bus.stops.size(); ++idx) {
+      GeneratedStop& from = stops[bus.stops[idx]];
+      GeneratedStop& to = stops[bus.stops[idx + 1]];
+      from.distances.emplace(bus.stops[idx + 1], RoadDistance(from, to, random));
+      // Half of the reverse directions get their own distance, the rest fall
+      // back to the forward one.
+      if(!bus.is_roundtrip && random.Below(2) == 0) {
+        to.distances.emplace(bus.stops[idx], RoadDistance(to, from, random));
+      }
+    }
+  }
+
+  // Coordinates need more digits than responses get.
+  const streamsize output_precision = output.precision(10);
+  Json::Writer writer(output);
+  output.precision(output_precision);
+  writer.BeginObject();
+  writer.Key("routing_settings");
+  writer.BeginObject();
+  writer.Key("bus_wait_time");
+  writer.Value(params.bus_wait_time);
+  writer.Key("bus_velocity");
+  writer.Value(params.bus_velocity);
+  writer.EndObject();
+
+  writer.Key("base_requests");
+  writer.BeginArray();
+  for(const GeneratedStop& stop: stops) {
+    writer.BeginObject();
+    writer.Key("type");
+    writer.Value("Stop");
+    writer.Key("name");
+    writer.Value(stop.name);
+    writer.Key("latitude");
+    writer.Value(stop.latitude);
+    writer.Key("longitude");
+    writer.Value(stop.longitude);
+    writer.Key("road_distances");
+    writer.BeginObject();
+    for(const auto& [to, distance]: stop.distances) {
+      writer.Key(stops[to].name);
+      writer.Value(distance);
+    }
+    writer.EndObject();
+    writer.EndObject();
+  }
+  for(size_t idx = 0; idx < buses.size(); ++idx) {
+    writer.BeginObject();
+    writer.Key("type");
+    writer.Value("Bus");
+    writer.Key("name");
+    writer.Value(BusName(idx));
+    writer.Key("stops");
+    writer.BeginArray();
+    for(int stop: buses[idx].stops) {
+      writer.Value(stops[stop].name);
+    }
+    writer.EndArray();
+    writer.Key("is_roundtrip");
+    writer.Value(buses[idx].is_roundtrip);
+    writer.EndObject();
+  }
+  writer.EndArray();
+
+  writer.Key("stat_requests");
+  writer.BeginArray();
+  const int total_weight = params.bus_query_weight + params.stop_query_weight + params.route_query_weight;
+  for(int id = 0; id < params.query_count && total_weight > 0; ++id) {
+    const int kind = random.Below(total_weight);
+    writer.BeginObject();
+    writer.Key("id");
+    writer.Value(id);
+    writer.Key("type");
+    if(kind < params.bus_query_weight) {
+      writer.Value("Bus");
+      writer.Key("name");
+      // About one query in twenty asks for a bus that does not exist.
+      writer.Value(BusName(random.Below(params.bus_count + params.bus_count / 20 + 1)));
+    } else if(kind < params.bus_query_weight + params.stop_query_weight) {
+      writer.Value("Stop");
+      writer.Key("name");
+      const uint64_t stop = random.Below(params.stop_count + params.stop_count / 20 + 1);
+      writer.Value(stop < stops.size() ? stops[stop].name : "Missing stop " + to_string(stop));
+    } else {
+      writer.Value("Route");
+      writer.Key("from");
+      writer.Value(stops[random.Below(params.stop_count)].name);
+      writer.Key("to");
+      writer.Value(stops[random.Below(params.stop_count)].name);
+    }
+    writer.EndObject();
+  }
+  writer.EndArray();
+  writer.EndObject();
+}
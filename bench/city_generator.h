@@ -0,0 +1,32 @@
+#pragma once
+
+#include <cstdint>
+#include <ostream>
+
+// Parameters of a synthetic city. The same parameters always give the same
+// document: the generator only uses its own seeded engine and integer
+// arithmetic, never the implementation-defined standard distributions.
+struct CityParams {
+  int stop_count = 1000;
+  int bus_count = 100;
+  // Stops per bus, before the first stop is repeated at the end of a roundtrip.
+  int min_route_length = 5;
+  int max_route_length = 20;
+  double roundtrip_ratio = 0.4;
+
+  int query_count = 10000;
+  // Relative weights of the stat request types.
+  int bus_query_weight = 1;
+  int stop_query_weight = 1;
+  int route_query_weight = 3;
+
+  int bus_wait_time = 6;
+  double bus_velocity = 40;
+  uint64_t seed = 1;
+};
+
+// Writes an input document in the base_requests / stat_requests schema.
+// Stops lie in a square about 20 km wide. Road distances follow the straight
+// line distance times a random detour factor, so every curvature is at least 1.
+// A few Bus and Stop queries ask for names that do not exist.
+void GenerateCity(const CityParams& params, std::ostream& output);
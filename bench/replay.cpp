@@ -0,0 +1,345 @@
+// Replays the stat requests of a captured input document against a network
+// built from its base requests, as many times as asked, and prints throughput
+// and latency percentiles as JSON. With --golden every response of every
+// repetition is checked against a recorded output, e.g. json/output1.json.
+//
+// Build from the repository root:
+//   g++ -std=c++17 -O2 -pthread -Iinc bench/replay.cpp
+//       $(ls src/*.cpp | grep -v main.cpp) -o transport_replay
+//
+// Usage:
+//   transport_replay INPUT [--golden OUTPUT] [--repeat N] [--threads N]
+//       [--order original|shuffled|by_source] [--seed N] [--route-cache-bytes N]
+//
+// Exits with 1 if any response differs from the golden output.
+#include "Requests.h"
+#include "json.h"
+#include "metrics.h"
+#include "thread_pool.h"
+
+#include <algorithm>
+#include <chrono>
+#include <cmath>
+#include <cstdlib>
+#include <iostream>
+#include <map>
+#include <random>
+#include <string>
+#include <unordered_map>
+#include <vector>
+
+using namespace std;
+
+namespace {
+
+using Clock = chrono::steady_clock;
+
+enum class Order {
+  ORIGINAL,
+  SHUFFLED,
+  BY_SOURCE,
+};
+
+const unordered_map<string_view, Order> ORDER = {
+    {"original", Order::ORIGINAL},
+    {"shuffled", Order::SHUFFLED},
+    {"by_source", Order::BY_SOURCE},
+};
+
+struct ReplayOptions {
+  string input_file;
+  string golden_file;
+  int repeat = 5;
+  size_t thread_count = 1;
+  Order order = Order::ORIGINAL;
+  uint64_t seed = 1;
+  optional<size_t> route_cache_bytes;
+};
+
+[[noreturn]] void Usage(const string& message) {
+  cerr << "transport_replay: " << message << endl;
+  exit(1);
+}
+
+ReplayOptions ParseOptions(int argc, const char* argv[]) {
+  if(argc < 2) {
+    Usage("expected an input document");
+  }
+  ReplayOptions options;
+  options.input_file = argv[1];
+  for(int idx = 2; idx < argc; idx += 2) {
+    const string_view name = argv[idx];
+    if(idx + 1 == argc) {
+      Usage("missing value of " + string(name));
+    }
+    const string value = argv[idx + 1];
+    if(name == "--golden") {
+      options.golden_file = value;
+    } else if(name == "--repeat") {
+      options.repeat = stoi(value);
+    } else if(name == "--threads") {
+      options.thread_count = stoul(value);
+    } else if(name == "--order") {
+      const auto it = ORDER.find(value);
+      if(it == ORDER.end()) {
+        Usage("--order expects original, shuffled or by_source");
+      }
+      options.order = it->second;
+    } else if(name == "--seed") {
+      options.seed = stoull(value);
+    } else if(name == "--route-cache-bytes") {
+      options.route_cache_bytes = stoull(value);
+    } else {
+      Usage("unknown option " + string(name));
+    }
+  }
+  if(options.repeat < 1) {
+    Usage("--repeat must be positive");
+  }
+  return options;
+}
+
+const char* REQUEST_TYPE_NAMES[] = {"Stop", "Bus", "Route"};
+
+const pair<const char*, double> LATENCY_PERCENTILES[] = {
+    {"p50_us", 0.5}, {"p90_us", 0.9}, {"p99_us", 0.99}, {"p99.9_us", 0.999},
+};
+
+// Route requests sort by their source stop, the others by the name they ask
+// for; the sort is stable, so equal keys keep their original order.
+string_view GetSourceKey(const StatRequest& request) {
+  if(const auto* route = get_if<ReadRouteRequest>(&request)) {
+    return route->from;
+  } else if(const auto* bus = get_if<ReadBusRequest>(&request)) {
+    return bus->bus_name;
+  } else {
+    return get<ReadStopRequest>(request).stop_name;
+  }
+}
+
+vector<size_t> MakeOrder(const vector<StatRequest>& requests, Order order, uint64_t seed) {
+  vector<size_t> indices(requests.size());
+  for(size_t idx = 0; idx < indices.size(); ++idx) {
+    indices[idx] = idx;
+  }
+  switch(order) {
+    case Order::ORIGINAL:
+      break;
+    case Order::SHUFFLED:
+      shuffle(begin(indices), end(indices), mt19937_64(seed));
+      break;
+    case Order::BY_SOURCE:
+      stable_sort(begin(indices), end(indices), [&requests](size_t lhs, size_t rhs) {
+        return make_pair(requests[lhs].index(), GetSourceKey(requests[lhs])) <
+            make_pair(requests[rhs].index(), GetSourceKey(requests[rhs]));
+      });
+      break;
+  }
+  return indices;
+}
+
+// Golden outputs are printed with six significant digits.
+bool SameNumber(double lhs, double rhs) {
+  return abs(lhs - rhs) <= 1e-4 * max(1.0, abs(rhs));
+}
+
+bool SameNode(const Json::Node& lhs, const Json::Node& rhs) {
+  if((lhs.IsInt() || lhs.IsDouble()) && (rhs.IsInt() || rhs.IsDouble())) {
+    return SameNumber(lhs.AsDouble(), rhs.AsDouble());
+  }
+  if(lhs.IsString() && rhs.IsString()) {
+    return lhs.AsString() == rhs.AsString();
+  }
+  if(lhs.IsBool() && rhs.IsBool()) {
+    return lhs.AsBool() == rhs.AsBool();
+  }
+  if(lhs.IsArray() && rhs.IsArray()) {
+    const auto& lhs_array = lhs.AsArray();
+    const auto& rhs_array = rhs.AsArray();
+    return lhs_array.size() == rhs_array.size() &&
+        equal(begin(lhs_array), end(lhs_array), begin(rhs_array), SameNode);
+  }
+  if(lhs.IsMap() && rhs.IsMap()) {
+    const auto& lhs_map = lhs.AsMap();
+    const auto& rhs_map = rhs.AsMap();
+    return lhs_map.size() == rhs_map.size() &&
+        equal(begin(lhs_map), end(lhs_map), begin(rhs_map), [](const auto& lhs_item, const auto& rhs_item) {
+          return lhs_item.first == rhs_item.first && SameNode(lhs_item.second, rhs_item.second);
+        });
+  }
+  return false;
+}
+
+// Several routes may share the optimal time, so a route response only has to
+// match the golden total time and be consistent with its own items.
+bool MatchesGolden(const Json::Node& response, const Json::Node& golden) {
+  const auto& golden_map = golden.AsMap();
+  const auto& response_map = response.AsMap();
+  const auto golden_time = golden_map.find("total_time");
+  if(golden_time == golden_map.end()) {
+    return SameNode(response, golden);
+  }
+  const auto response_time = response_map.find("total_time");
+  if(response_time == response_map.end() ||
+      !SameNumber(response_time->second.AsDouble(), golden_time->second.AsDouble())) {
+    return false;
+  }
+  double items_time = 0;
+  for(const Json::Node& item: response_map.at("items").AsArray()) {
+    items_time += item.AsMap().at("time").AsDouble();
+  }
+  return SameNumber(items_time, response_time->second.AsDouble());
+}
+
+void WriteLatencies(Json::Writer& writer, const Metrics::Histogram& histogram) {
+  auto to_microseconds = [](Clock::duration duration) {
+    return chrono::duration<double, micro>(duration).count();
+  };
+  writer.BeginObject();
+  writer.Key("count");
+  writer.Value(static_cast<double>(histogram.GetCount()));
+  for(const auto& [key, quantile]: LATENCY_PERCENTILES) {
+    writer.Key(key);
+    writer.Value(to_microseconds(histogram.GetPercentile(quantile)));
+  }
+  writer.Key("max_us");
+  writer.Value(to_microseconds(histogram.GetMax()));
+  writer.EndObject();
+}
+
+}
+
+int main(int argc, const char* argv[]) {
+  const ReplayOptions options = ParseOptions(argc, argv);
+
+  const Clock::time_point build_start = Clock::now();
+  JsonParser jp;
+  const Json::InputBuffer input = Json::InputBuffer::FromFile(options.input_file);
+  JsonParser::InputSections sections = jp.SplitInput(input.GetText());
+  RoutingSettings settings = jp.GetRoutingSettings(sections.routing_settings.GetRoot());
+  settings.thread_count = options.thread_count;
+  if(options.route_cache_bytes) {
+    settings.route_cache_bytes = *options.route_cache_bytes;
+  }
+  RouteManager rm(settings);
+  Visitor visitor;
+  visitor.SetRouteManager(&rm);
+  {
+    const BaseRequests base_requests = jp.ReadBaseRequests(sections.base_requests);
+    for(const ModifyStopRequest& request: base_requests.stops) {
+      visitor.Visit(request);
+    }
+    for(const ModifyBusRequest& request: base_requests.buses) {
+      visitor.Visit(request);
+    }
+  }
+  rm.BuildRouterIfNotExists();
+  const double build_ms = chrono::duration<double, milli>(Clock::now() - build_start).count();
+
+  vector<StatRequest> requests;
+  StatRequestStream stat_stream(sections.stat_requests);
+  while(!stat_stream.AtEnd()) {
+    for(StatRequest& request: stat_stream.ReadBatch(1024)) {
+      requests.push_back(move(request));
+    }
+  }
+
+  // Golden responses by request id.
+  unordered_map<int, Json::Node> golden;
+  if(!options.golden_file.empty()) {
+    const Json::InputBuffer golden_input = Json::InputBuffer::FromFile(options.golden_file);
+    const Json::Document golden_doc = Json::Load(golden_input.GetText());
+    for(const Json::Node& response: golden_doc.GetRoot().AsArray()) {
+      golden.emplace(response.AsMap().at("request_id").AsInt(), response);
+    }
+  }
+
+  ThreadPool pool(settings.thread_count);
+  const vector<size_t> order = MakeOrder(requests, options.order, options.seed);
+  Metrics::Histogram latency;
+  map<string, Metrics::Histogram> type_latencies;
+  vector<Metrics::Histogram*> request_latencies;
+  for(const StatRequest& request: requests) {
+    request_latencies.push_back(&type_latencies[REQUEST_TYPE_NAMES[request.index()]]);
+  }
+  vector<Json::Node> responses(requests.size());
+  vector<double> throughputs;
+  size_t mismatch_count = 0;
+  int first_mismatch_id = -1;
+  for(int run = 0; run < options.repeat; ++run) {
+    const Clock::time_point run_start = Clock::now();
+    pool.ParallelFor(order.size(), [&](size_t position) {
+      const size_t idx = order[position];
+      const Clock::time_point request_start = Clock::now();
+      responses[idx] = visitor.Visit(requests[idx]);
+      const Clock::duration elapsed = Clock::now() - request_start;
+      latency.Record(elapsed);
+      request_latencies[idx]->Record(elapsed);
+    });
+    const double run_seconds = chrono::duration<double>(Clock::now() - run_start).count();
+    throughputs.push_back(requests.size() / run_seconds);
+
+    if(golden.empty()) {
+      continue;
+    }
+    for(const Json::Node& response: responses) {
+      const int id = response.AsMap().at("request_id").AsInt();
+      const auto it = golden.find(id);
+      if(it == golden.end() || !MatchesGolden(response, it->second)) {
+        if(mismatch_count++ == 0) {
+          first_mismatch_id = id;
+        }
+      }
+    }
+  }
+
+  cout.precision(6);
+  Json::Writer writer(cout);
+  writer.BeginObject();
+  writer.Key("input");
+  writer.Value(options.input_file);
+  writer.Key("requests");
+  writer.Value(static_cast<int>(requests.size()));
+  writer.Key("repeat");
+  writer.Value(options.repeat);
+  writer.Key("threads");
+  writer.Value(static_cast<int>(pool.GetThreadCount()));
+  writer.Key("order");
+  writer.Value(options.order == Order::ORIGINAL ? "original" :
+      options.order == Order::SHUFFLED ? "shuffled" : "by_source");
+  writer.Key("build_ms");
+  writer.Value(build_ms);
+  writer.Key("throughput_rps");
+  writer.BeginObject();
+  writer.Key("min");
+  writer.Value(*min_element(begin(throughputs), end(throughputs)));
+  writer.Key("max");
+  writer.Value(*max_element(begin(throughputs), end(throughputs)));
+  writer.EndObject();
+  writer.Key("latency");
+  WriteLatencies(writer, latency);
+  writer.Key("latency_by_type");
+  writer.BeginObject();
+  for(const auto& [type_name, histogram]: type_latencies) {
+    writer.Key(type_name);
+    WriteLatencies(writer, histogram);
+  }
+  writer.EndObject();
+  const auto cache_stats = rm.GetRouteCacheStats();
+  writer.Key("route_cache_hits");
+  writer.Value(static_cast<double>(cache_stats.hits));
+  writer.Key("route_cache_misses");
+  writer.Value(static_cast<double>(cache_stats.misses));
+  if(!golden.empty()) {
+    writer.Key("mismatches");
+    writer.Value(static_cast<int>(mismatch_count));
+    if(mismatch_count > 0) {
+      writer.Key("first_mismatch_id");
+      writer.Value(first_mismatch_id);
+    }
+  }
+  writer.EndObject();
+  writer.Flush();
+  cout << endl;
+  return mismatch_count == 0 ? 0 : 1;
+}
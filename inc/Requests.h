@@ -7,147 +7,161 @@
 #include <set>
 #include <string_view>
 #include <sstream>
+#include <optional>
+#include <variant>
 #include "RouteManager.h"
 #include "json.h"
 
 class Visitor;
-class Request;
-using RequestHolder = std::unique_ptr<Request>;
 
 //------------------Request---------------------------//
-class Request {
-public:
-  enum class Type {
-	READ_STOP,
-    READ_BUS,
-	READ_ROUTE,
-    MODIFY_BUS,
-	MODIFY_STOP,
-  };
-
-  Request(Type type);
-  static RequestHolder Create(Type type);
-  virtual void ParseFrom(const Json::Node& node) = 0;
-  virtual ~Request() = default;
-  virtual std::optional<Json::Node> Accept(const Visitor& v) const = 0;
-  const Type type;
+enum class RequestType {
+  READ_STOP,
+  READ_BUS,
+  READ_ROUTE,
+  MODIFY_BUS,
+  MODIFY_STOP,
 };
 
-const std::unordered_map<std::string_view, Request::Type> MODIFY_REQUEST_TYPE = {
-    {"Bus", Request::Type::MODIFY_BUS},
-    {"Stop", Request::Type::MODIFY_STOP}
+const std::unordered_map<std::string_view, RequestType> MODIFY_REQUEST_TYPE = {
+    {"Bus", RequestType::MODIFY_BUS},
+    {"Stop", RequestType::MODIFY_STOP}
 };
 
-const std::unordered_map<std::string_view, Request::Type> READ_REQUEST_TYPE = {
-    {"Bus", Request::Type::READ_BUS},
-	{"Stop", Request::Type::READ_STOP},
-	{"Route", Request::Type::READ_ROUTE},
+const std::unordered_map<std::string_view, RequestType> READ_REQUEST_TYPE = {
+    {"Bus", RequestType::READ_BUS},
+	{"Stop", RequestType::READ_STOP},
+	{"Route", RequestType::READ_ROUTE},
 };
 
-class ReadStopRequest : public Request {
-public:
-  ReadStopRequest();
-  void ParseFrom(const Json::Node& node) override;
-  std::optional<Json::Node> Accept(const Visitor& v) const override;
+// Requests are plain values: they are kept in contiguous vectors and handed to
+// Visitor by their static type, without a common base class.
+struct ReadStopRequest {
+  void ParseFrom(const Json::CompactNode& node);
   int id;
   std::string stop_name;
 };
 
-class ReadBusRequest : public Request {
-public:
-  ReadBusRequest();
-  void ParseFrom(const Json::Node& node) override;
-  std::optional<Json::Node> Accept(const Visitor& v) const override;
+struct ReadBusRequest {
+  void ParseFrom(const Json::CompactNode& node);
   int id;
   std::string bus_name;
 };
 
-class ReadRouteRequest : public Request {
-public:
-  ReadRouteRequest();
-  void ParseFrom(const Json::Node& node) override;
-  std::optional<Json::Node> Accept(const Visitor& v) const override;
+struct ReadRouteRequest {
+  void ParseFrom(const Json::CompactNode& node);
   int id;
   std::string from, to;
 };
 
-class ModifyBusRequest : public Request {
-public:
-  ModifyBusRequest();
-  void ParseFrom(const Json::Node& node) override;
-  std::optional<Json::Node> Accept(const Visitor& v) const override;
+struct ModifyBusRequest {
+  void ParseFrom(const Json::CompactNode& node);
 
   std::vector<std::string> stops;
   std::string bus_name;
   bool cycle = false;
 };
 
-class ModifyStopRequest : public Request {
-public:
-  ModifyStopRequest();
-  void ParseFrom(const Json::Node& node) override;
-  std::optional<Json::Node> Accept(const Visitor& v) const override;
-
+struct ModifyStopRequest {
+  void ParseFrom(const Json::CompactNode& node);
 
   double latitude, longitude;
   std::string stop_name;
   std::vector<DistanceToStop> distances;
 };
+
+// The alternatives go in the order of their RequestType, so index() of a stat
+// request is its type.
+using StatRequest = std::variant<ReadStopRequest, ReadBusRequest, ReadRouteRequest>;
 //------------------Request---------------------------------------//
 
 //------------------Parsing Functions-----------------------------//
-std::optional<Request::Type> ConvertRequestTypeFromString(std::string_view type_str,
-		const std::unordered_map<std::string_view, Request::Type>& str_to_type);
+// Base requests kept apart by type, each in input order: all stops have to be
+// applied before the first bus.
+struct BaseRequests {
+  std::vector<ModifyStopRequest> stops;
+  std::vector<ModifyBusRequest> buses;
+};
+
+std::optional<RequestType> ConvertRequestTypeFromString(std::string_view type_str,
+		const std::unordered_map<std::string_view, RequestType>& str_to_type);
 
 class JsonParser {
 public:
 
-  RoutingSettings GetRoutingSettings(const Json::Document& doc) {
-	Json::Node node = doc.GetRoot().AsMap().at("routing_settings");
-	return {node.AsMap().at("bus_wait_time").AsInt(),
+  RoutingSettings GetRoutingSettings(const Json::CompactDocument& doc) {
+	return GetRoutingSettings(doc.GetRoot().AsMap().at("routing_settings"));
+  }
+  RoutingSettings GetRoutingSettings(const Json::CompactNode& node) {
+	RoutingSettings settings{node.AsMap().at("bus_wait_time").AsInt(),
 		node.AsMap().at("bus_velocity").AsDouble()};
+	if(node.AsMap().count("router")) {
+	  settings.router_type = ROUTER_TYPE.at(node.AsMap().at("router").AsString());
+	}
+	if(node.AsMap().count("thread_count")) {
+	  settings.thread_count = GetSizeSetting(node.AsMap().at("thread_count"), "thread_count");
+	}
+	if(node.AsMap().count("graph_model")) {
+	  settings.graph_model = GRAPH_MODEL.at(node.AsMap().at("graph_model").AsString());
+	}
+	if(node.AsMap().count("route_cache_bytes")) {
+	  settings.route_cache_bytes = GetSizeSetting(node.AsMap().at("route_cache_bytes"), "route_cache_bytes");
+	}
+	return settings;
   }
-  std::vector<RequestHolder> ParseBaseRequests(const Json::Document& doc) {
-	return ParseRequests(doc.GetRoot().AsMap().at("base_requests"), true);
+  // Reads a setting that must be a non-negative integer. Values past the int
+  // range are parsed as doubles, so both kinds of number are accepted; anything
+  // else throws std::invalid_argument naming the setting.
+  static size_t GetSizeSetting(const Json::CompactNode& node, std::string_view name);
+  std::string GetSerializationFile(const Json::CompactNode& node) {
+	return std::string(node.AsMap().at("file").AsString());
   }
-  std::vector<RequestHolder> ParseStatRequests(const Json::Document& doc) {
-	return ParseRequests(doc.GetRoot().AsMap().at("stat_requests"), false);
+  BaseRequests ParseBaseRequests(const Json::CompactDocument& doc) {
+	return ParseBaseRequests(doc.GetRoot().AsMap().at("base_requests"));
   }
-private:
-  std::vector<RequestHolder> ParseRequests(const Json::Node& node_,
-		  bool is_modify) {
-	using Json::Node;
-	std::vector<RequestHolder> requests;
-	for(const Node& node: node_.AsArray()) {
-	  auto request_type = [is_modify, &node]{
-	if(is_modify) {
-	  return ConvertRequestTypeFromString(node.AsMap().
-		at("type").AsString(), MODIFY_REQUEST_TYPE);
-	} else {
-	  return ConvertRequestTypeFromString(node.AsMap().
-		at("type").AsString(), READ_REQUEST_TYPE);
-	}
-	}();
+  BaseRequests ParseBaseRequests(const Json::CompactNode& node);
+  std::vector<StatRequest> ParseStatRequests(const Json::CompactDocument& doc);
+
+  // Reads the base_requests array straight from its text into requests,
+  // without building a DOM. Requests of unknown type are skipped; a missing
+  // field throws std::out_of_range like the DOM path does.
+  BaseRequests ReadBaseRequests(std::string_view base_requests);
+
+  // Top-level sections of an input document. The settings are parsed, each
+  // into an arena of its own; base_requests and stat_requests are only located
+  // in the input text, to be read with ReadBaseRequests and StatRequestStream.
+  struct InputSections {
+	Json::CompactDocument routing_settings;
+	Json::CompactDocument serialization_settings;
+	std::string_view base_requests;
+	std::string_view stat_requests;
+  };
+  InputSections SplitInput(std::string_view text);
 
-	if (!request_type) {
-	continue;
-	}
+  // Returns nullopt for a request of unknown type.
+  static std::optional<StatRequest> ParseStatRequest(const Json::CompactNode& node);
+};
 
-	RequestHolder request = Request::Create(*request_type);
-	if (request) {
-	request->ParseFrom(node);
-	};
-	requests.push_back(std::move(request));
-	}
-	return requests;
-  }
+// Reads the stat_requests array a few elements at a time, so only one batch of
+// requests exists in memory at once.
+class StatRequestStream {
+public:
+  explicit StatRequestStream(std::string_view stat_requests);
+  bool AtEnd() const;
+  // Parses up to max_count more elements; requests of unknown type are skipped.
+  std::vector<StatRequest> ReadBatch(size_t max_count);
+private:
+  Json::Parser parser;
+  // Holds the DOM of the current batch only.
+  Json::Arena arena;
+  bool at_end;
 };
 
 Json::Node PrintBusResponse(std::optional<BusStats> stats, int id);
 
 Json::Node PrintStopResponse(std::optional<std::set<std::string_view>> stats, int id);
 
-Json::Node PrintRouteResponse(std::optional<RouteStats<double>> stats, int id);
+Json::Node PrintRouteResponse(std::shared_ptr<const RouteStats<double>> stats, int id);
 
 //------------------Parsing Functions-----------------------------//
 
@@ -159,6 +173,7 @@ public:
   Json::Node Visit(const ReadBusRequest&) const;
   Json::Node Visit(const ReadRouteRequest&) const;
   Json::Node Visit(const ReadStopRequest&) const;
+  Json::Node Visit(const StatRequest&) const;
   void Visit(const ModifyBusRequest&) const;
   void Visit(const ModifyStopRequest&) const;
   void SetRouteManager(RouteManager* rm_);
@@ -166,7 +181,22 @@ private:
   RouteManager* rm;
   std::unique_ptr<Strategy> cycle_strategy;
   std::unique_ptr<Strategy> not_cycle_strategy;
+  // Latency of every Visit by request type, null unless stats are enabled.
+  // route_print_latency covers building the Route response on its own.
+  Metrics::Histogram* bus_latency;
+  Metrics::Histogram* stop_latency;
+  Metrics::Histogram* route_latency;
+  Metrics::Histogram* route_print_latency;
+  Metrics::Histogram* modify_bus_latency;
+  Metrics::Histogram* modify_stop_latency;
 };
 
 //-------------------------Tests--------------------------------//
 void TestModifyAndReadRequest();
+void TestReadBaseRequests();
+void TestJsonLoad();
+void TestJsonWriter();
+void TestCompactJson();
+void TestRoutingSettings();
+void TestMetrics();
+void TestTrace();
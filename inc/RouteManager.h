@@ -5,29 +5,63 @@
 #include <vector>
 #include <memory>
 #include <set>
+#include <cstdint>
+#include <algorithm>
 #include <cmath>
 #include <optional>
 #include "graph.h"
 #include <string_view>
+#include <mutex>
 #include "router.h"
+#include "dijkstra_router.h"
+#include "edge_index.h"
+#include "string_pool.h"
+#include "serialization.h"
+#include "lru_cache.h"
+#include "metrics.h"
 
 using GraphHolder = std::unique_ptr<Graph::DirectedWeightedGraph<double>>;
-using RouterHolder = std::unique_ptr<Graph::Router<double>>;
+using RouterHolder = std::unique_ptr<Graph::RouterBase<double>>;
+
+// Stops and buses are interned to dense ids when they are first mentioned, so
+// everything past the request boundary indexes vectors instead of hashing names.
+// Their names are copied into the RouteManager's string pool, so the requests
+// they came from may be freed once they have been applied.
+using StopId = uint32_t;
+using BusId = uint32_t;
+
+enum class RouterType {
+  FLOYD_WARSHALL,
+  DIJKSTRA,
+};
 
-struct StringPairHasher {
-    size_t operator()(const std::pair<std::string_view, std::string_view>& p) const {
-    	size_t r1 = shash(p.first);
-    	size_t r2 = shash(p.second);
+const std::unordered_map<std::string_view, RouterType> ROUTER_TYPE = {
+    {"floyd_warshall", RouterType::FLOYD_WARSHALL},
+    {"dijkstra", RouterType::DIJKSTRA},
+};
 
-    	const size_t coef = 2946901;
-    	return r1 * coef + r2;
-    }
-    std::hash<std::string_view> shash;
+// STOP_TO_STOP connects every stop with every later stop of each bus, so a bus
+// with k stops adds O(k^2) edges, each one charging the wait time.
+// TRANSIT gives every stop an arrival and a boarding vertex joined by a single
+// wait edge, and every bus a chain of ride vertices, so a bus adds O(k) edges.
+enum class GraphModel {
+  STOP_TO_STOP,
+  TRANSIT,
+};
+
+const std::unordered_map<std::string_view, GraphModel> GRAPH_MODEL = {
+    {"stop_to_stop", GraphModel::STOP_TO_STOP},
+    {"transit", GraphModel::TRANSIT},
 };
 
 struct RoutingSettings {
   int bus_wait_time;
   double bus_velocity;
+  RouterType router_type = RouterType::FLOYD_WARSHALL;
+  size_t thread_count = 0;
+  GraphModel graph_model = GraphModel::STOP_TO_STOP;
+  // Byte budget of the route cache, 0 disables it.
+  size_t route_cache_bytes = 64 << 20;
 };
 
 struct BusStats {
@@ -37,6 +71,9 @@ struct BusStats {
   double curvature;
 };
 
+// Describes both a route item and the graph edge it comes from. An edge with a
+// start stop opens a new route item; an edge without one (a TRANSIT boarding,
+// ride or alighting edge) is merged into the item opened before it.
 struct ElementOfRoute {
   std::string_view bus_name;
   int span_count;
@@ -44,6 +81,20 @@ struct ElementOfRoute {
   double el_time;
 };
 
+inline void AppendEdgeToRoute(std::vector<ElementOfRoute>& elements_of_route,
+		const ElementOfRoute& edge_element) {
+  if(!edge_element.start_stop_name.empty()) {
+	elements_of_route.push_back(edge_element);
+	return;
+  }
+  ElementOfRoute& element = elements_of_route.back();
+  if(!edge_element.bus_name.empty()) {
+	element.bus_name = edge_element.bus_name;
+  }
+  element.span_count += edge_element.span_count;
+  element.el_time += edge_element.el_time;
+}
+
 template<typename Weight>
 struct RouteStats {
   std::vector<ElementOfRoute> elements_of_route;
@@ -72,6 +123,14 @@ struct Coords {
 
 class StopDataBase {
 public:
+  std::string_view GetName() const {
+	return name;
+  }
+
+  void SetName(std::string_view name_) {
+	name = name_;
+  }
+
   Coords GetCoords() const{
 	return coords;
   }
@@ -88,12 +147,29 @@ public:
 	return buses;
   }
 
-  std::unordered_map<std::string_view, int>& GetDistance() {
-  	return distance;
+  // A stop only has a handful of neighbours, so the road distances are kept in
+  // a flat list and searched linearly.
+  std::optional<int> GetDistance(StopId to) const {
+	for(const auto& [stop_id, distance]: distances) {
+	  if(stop_id == to) {
+		return distance;
+	  }
+	}
+	return std::nullopt;
+  }
+
+  const std::vector<std::pair<StopId, int>>& GetDistances() const {
+	return distances;
   }
 
-  const std::unordered_map<std::string_view, int>& GetDistance() const {
-	return distance;
+  void SetDistance(StopId to, int distance) {
+	for(auto& [stop_id, old_distance]: distances) {
+	  if(stop_id == to) {
+		old_distance = distance;
+		return;
+	  }
+	}
+	distances.emplace_back(to, distance);
   }
 
   void SetVertexId(size_t id) {
@@ -103,65 +179,127 @@ public:
   size_t GetVertexId() const{
   	return vertex_id;
   }
+
+  bool HasVertexId() const {
+	return vertex_id != NO_VERTEX;
+  }
+
+  void SetBoardingVertexId(size_t id) {
+	boarding_vertex_id = id;
+  }
+
+  size_t GetBoardingVertexId() const{
+  	return boarding_vertex_id;
+  }
+
+  bool HasBoardingVertexId() const {
+	return boarding_vertex_id != NO_VERTEX;
+  }
 private:
+  static constexpr size_t NO_VERTEX = static_cast<size_t>(-1);
+
+  std::string_view name;
   Coords coords;
   std::set<std::string_view> buses;
-  std::unordered_map<std::string_view, int> distance;
-  size_t vertex_id;
+  std::vector<std::pair<StopId, int>> distances;
+  size_t vertex_id = NO_VERTEX;
+  size_t boarding_vertex_id = NO_VERTEX;
 };
 
 //---------------------Pattern Strategy-----------------------//
 class Strategy {
 public:
   virtual ~Strategy() = default;
-  virtual int ComputeStopsOnRoute(const std::vector<std::string>& stops) const = 0;
+  virtual int ComputeStopsOnRoute(const std::vector<StopId>& stops) const = 0;
 
-  virtual DistanceStats ComputeDistancesOnRoute(const std::vector<std::string>& stops,
-		  const std::unordered_map<std::string_view, StopDataBase>& stop_db) const  = 0;
+  virtual DistanceStats ComputeDistancesOnRoute(const std::vector<StopId>& stops,
+		  const std::vector<StopDataBase>& stop_db) const  = 0;
 
   double ComputeDistance(const Coords& lhs, const Coords& rhs) const;
 
-  int ComputeUniqueStopsOnRoute(const std::vector<std::string>& stops) const;
+  int ComputeUniqueStopsOnRoute(const std::vector<StopId>& stops) const;
 
-  void FillBusesInStopDB(const std::vector<std::string>& stops,
+  void FillBusesInStopDB(const std::vector<StopId>& stops,
 		  std::string_view bus_name,
-		  std::unordered_map<std::string_view, StopDataBase>& stop_db) {
-	for(const std::string& stop_name: stops) {
-	  stop_db[stop_name].GetBuses().insert(bus_name);
+		  std::vector<StopDataBase>& stop_db) {
+	for(const StopId stop_id: stops) {
+	  stop_db[stop_id].GetBuses().insert(bus_name);
 	}
   }
 
   virtual GraphHolder AddEdgesToGraph(std::string_view bus_name,
-		  const std::vector<std::string>& stops,
-		  const std::unordered_map<std::string_view, StopDataBase>& stop_db,
+		  const std::vector<StopId>& stops,
+		  const std::vector<StopDataBase>& stop_db,
 		  std::vector<ElementOfRoute>& edge_to_element,
+		  Graph::EdgeIndex& edge_index,
 		  GraphHolder graph,
 		  const RoutingSettings& settings,
 		  const std::vector<int> real_distances,
 		  std::optional<std::vector<int>> reverse_distances) const = 0;
 
+  virtual GraphHolder AddRideEdgesToGraph(std::string_view bus_name,
+		  const std::vector<StopId>& stops,
+		  const std::vector<StopDataBase>& stop_db,
+		  std::vector<ElementOfRoute>& edge_to_element,
+		  GraphHolder graph,
+		  const RoutingSettings& settings,
+		  const std::vector<int>& real_distances,
+		  const std::optional<std::vector<int>>& reverse_distances) const = 0;
+
+  // TRANSIT model: one ride vertex per stop of the run, a boarding edge into it
+  // (except at the last stop), an alighting edge out of it (except at the first
+  // stop) and one ride edge per segment. distances[i] is the length of the
+  // segment from stops[i] to stops[i + 1].
+  template <typename StopIt, typename DistanceIt>
+  GraphHolder AddRideChain(std::string_view bus_name,
+		  StopIt stops_begin, StopIt stops_end, DistanceIt distances_begin,
+		  const std::vector<StopDataBase>& stop_db,
+		  std::vector<ElementOfRoute>& edge_to_element,
+		  GraphHolder graph,
+		  const RoutingSettings& settings) const {
+	std::optional<size_t> prev_ride_vertex;
+	for(auto it = stops_begin; it != stops_end; ++it) {
+	  const StopDataBase& stop = stop_db[*it];
+	  const size_t ride_vertex = graph->AddVertex();
+	  if(prev_ride_vertex) {
+		const double ride_time = (*distances_begin++ * 60) / (settings.bus_velocity * 1000);
+		graph->AddEdge({*prev_ride_vertex, ride_vertex, ride_time});
+		edge_to_element.push_back({bus_name, 1, {}, ride_time});
+		graph->AddEdge({ride_vertex, stop.GetVertexId(), 0});
+		edge_to_element.push_back({{}, 0, {}, 0});
+	  }
+	  if(next(it) != stops_end) {
+		graph->AddEdge({stop.GetBoardingVertexId(), ride_vertex, 0});
+		edge_to_element.push_back({bus_name, 0, {}, 0});
+	  }
+	  prev_ride_vertex = ride_vertex;
+	}
+	return graph;
+  }
+
   GraphHolder AddEdge(size_t vertex_from, size_t vertex_to,
 		  GraphHolder graph, double dist_sum,
 		  const RoutingSettings& settings,
 		  std::string_view bus_name,
 		  std::string_view start_stop_name,
 		  std::vector<ElementOfRoute>& edge_to_element,
+		  Graph::EdgeIndex& edge_index,
 		  int span_count) const {
 	if(vertex_from == vertex_to) {
 	  return graph;
 	}
 
-    for(size_t edge_id: graph->GetIncidentEdges(vertex_from)) {
-	  if(graph->GetEdge(edge_id).to == vertex_to) {
-		if(graph->GetEdge(edge_id).weight > ((dist_sum * 60) /
-		      (settings.bus_velocity * 1000)) + settings.bus_wait_time) {
-		  graph->GetEdge(edge_id).weight = ((dist_sum * 60) /
-			  (settings.bus_velocity * 1000)) + settings.bus_wait_time;
-		  edge_to_element[edge_id] = {bus_name, span_count, start_stop_name,
-			  (dist_sum * 60) / (settings.bus_velocity * 1000)};
-		}
-		return graph;
+	const auto [edge_id, inserted] = edge_index.Emplace(vertex_from, vertex_to,
+			graph->GetEdgeCount());
+	if(!inserted) {
+	  if(graph->GetEdge(edge_id).weight > ((dist_sum * 60) /
+		    (settings.bus_velocity * 1000)) + settings.bus_wait_time) {
+		graph->GetEdge(edge_id).weight = ((dist_sum * 60) /
+			(settings.bus_velocity * 1000)) + settings.bus_wait_time;
+		edge_to_element[edge_id] = {bus_name, span_count, start_stop_name,
+			(dist_sum * 60) / (settings.bus_velocity * 1000)};
 	  }
+	  return graph;
 	}
 
 	graph->AddEdge({vertex_from, vertex_to,
@@ -175,29 +313,30 @@ public:
 
 class CycleStrategy : public Strategy {
 public:
-  int ComputeStopsOnRoute(const std::vector<std::string>& stops) const override {
+  int ComputeStopsOnRoute(const std::vector<StopId>& stops) const override {
     return stops.size();
   }
 
-  DistanceStats ComputeDistancesOnRoute(const std::vector<std::string>& stops,
-		  const std::unordered_map<std::string_view, StopDataBase>& stop_db) const override {
+  DistanceStats ComputeDistancesOnRoute(const std::vector<StopId>& stops,
+		  const std::vector<StopDataBase>& stop_db) const override {
     double sum = 0;
     int real_sum = 0;
     std::vector<int> real_distances;
     real_distances.reserve(ComputeStopsOnRoute(stops));
 	for(auto it = begin(stops); it != prev(end(stops)); ++it) {
-	  sum += ComputeDistance(stop_db.at(*it).GetCoords(),
-			  stop_db.at(*next(it)).GetCoords());
-      real_distances.push_back(stop_db.at(*it).GetDistance().at(*next(it)));
+	  sum += ComputeDistance(stop_db[*it].GetCoords(),
+			  stop_db[*next(it)].GetCoords());
+      real_distances.push_back(stop_db[*it].GetDistance(*next(it)).value());
       real_sum += real_distances.back();
     }
 	return {real_sum, sum, std::move(real_distances), std::nullopt};
   }
 
   GraphHolder AddEdgesToGraph(std::string_view bus_name,
-		  const std::vector<std::string>& stops,
-		  const std::unordered_map<std::string_view, StopDataBase>& stop_db,
+		  const std::vector<StopId>& stops,
+		  const std::vector<StopDataBase>& stop_db,
 		  std::vector<ElementOfRoute>& edge_to_element,
+		  Graph::EdgeIndex& edge_index,
 		  GraphHolder graph,
 		  const RoutingSettings& settings,
 		  const std::vector<int> real_distances,
@@ -207,23 +346,35 @@ public:
       double dist_sum = 0;
       for(auto it2 = next(it); it2 != end(stops); ++it2) {
 	    dist_sum += real_distances[it2 - begin(stops) - 1];
-	    graph = AddEdge(stop_db.at(*it).GetVertexId(), stop_db.at(*it2).GetVertexId(),
+	    graph = AddEdge(stop_db[*it].GetVertexId(), stop_db[*it2].GetVertexId(),
 			std::move(graph), dist_sum, settings, bus_name,
-			*it, edge_to_element, it2 - it);
+			stop_db[*it].GetName(), edge_to_element, edge_index, it2 - it);
       }
     }
     return std::move(graph);
   }
+
+  GraphHolder AddRideEdgesToGraph(std::string_view bus_name,
+		  const std::vector<StopId>& stops,
+		  const std::vector<StopDataBase>& stop_db,
+		  std::vector<ElementOfRoute>& edge_to_element,
+		  GraphHolder graph,
+		  const RoutingSettings& settings,
+		  const std::vector<int>& real_distances,
+		  const std::optional<std::vector<int>>& /*reverse_distances*/) const override {
+    return AddRideChain(bus_name, begin(stops), end(stops), begin(real_distances),
+    		stop_db, edge_to_element, std::move(graph), settings);
+  }
 };
 
 class NotCycleStrategy : public Strategy {
 public:
-  int ComputeStopsOnRoute(const std::vector<std::string>& stops) const override {
+  int ComputeStopsOnRoute(const std::vector<StopId>& stops) const override {
     return stops.size() * 2 - 1;
   }
 
-  DistanceStats ComputeDistancesOnRoute(const std::vector<std::string>& stops,
-		  const std::unordered_map<std::string_view, StopDataBase>& stop_db) const override {
+  DistanceStats ComputeDistancesOnRoute(const std::vector<StopId>& stops,
+		  const std::vector<StopDataBase>& stop_db) const override {
 	double sum = 0;
 	int real_sum = 0;
 	std::vector<int> real_distances, reverse_distances;
@@ -231,20 +382,21 @@ public:
 	reverse_distances.reserve(ComputeStopsOnRoute(stops));
 
 	for(auto it = begin(stops); it != prev(end(stops)); ++it) {
-	  sum += 2 * ComputeDistance(stop_db.at(*it).GetCoords(),
-			  stop_db.at(*next(it)).GetCoords());
+	  sum += 2 * ComputeDistance(stop_db[*it].GetCoords(),
+			  stop_db[*next(it)].GetCoords());
 
-	  real_distances.push_back(stop_db.at(*it).GetDistance().at(*next(it)));
-	  reverse_distances.push_back(stop_db.at(*next(it)).GetDistance().at(*it));
+	  real_distances.push_back(stop_db[*it].GetDistance(*next(it)).value());
+	  reverse_distances.push_back(stop_db[*next(it)].GetDistance(*it).value());
 	  real_sum += (real_distances.back() + reverse_distances.back());
 	}
 	return {real_sum, sum, std::move(real_distances), std::move(reverse_distances)};
   }
 
   GraphHolder AddEdgesToGraph(std::string_view bus_name,
-		  const std::vector<std::string>& stops,
-		  const std::unordered_map<std::string_view, StopDataBase>& stop_db,
+		  const std::vector<StopId>& stops,
+		  const std::vector<StopDataBase>& stop_db,
 		  std::vector<ElementOfRoute>& edge_to_element,
+		  Graph::EdgeIndex& edge_index,
 		  GraphHolder graph,
 		  const RoutingSettings& settings,
 		  const std::vector<int> real_distances,
@@ -254,9 +406,9 @@ public:
 	  double dist_sum = 0;
 	  for(auto it2 = next(it); it2 != end(stops); ++it2) {
 		dist_sum += real_distances[it2 - begin(stops) - 1];
-		graph = AddEdge(stop_db.at(*it).GetVertexId(), stop_db.at(*it2).GetVertexId(),
+		graph = AddEdge(stop_db[*it].GetVertexId(), stop_db[*it2].GetVertexId(),
 			std::move(graph), dist_sum, settings, bus_name,
-			*it, edge_to_element, it2 - it);
+			stop_db[*it].GetName(), edge_to_element, edge_index, it2 - it);
 	  }
 	}
 
@@ -264,14 +416,28 @@ public:
 	  double dist_sum = 0;
 	  for(auto it2 = next(it); it2 != rend(stops); ++it2) {
 		dist_sum += (*reverse_distances)[reverse_distances->size() - (it2 - rbegin(stops))];
-		graph = AddEdge(stop_db.at(*it).GetVertexId(), stop_db.at(*it2).GetVertexId(),
+		graph = AddEdge(stop_db[*it].GetVertexId(), stop_db[*it2].GetVertexId(),
 			std::move(graph), dist_sum, settings, bus_name,
-			*it, edge_to_element, it2 - it);
+			stop_db[*it].GetName(), edge_to_element, edge_index, it2 - it);
 	  }
 	}
     return std::move(graph);
 
   }
+
+  GraphHolder AddRideEdgesToGraph(std::string_view bus_name,
+		  const std::vector<StopId>& stops,
+		  const std::vector<StopDataBase>& stop_db,
+		  std::vector<ElementOfRoute>& edge_to_element,
+		  GraphHolder graph,
+		  const RoutingSettings& settings,
+		  const std::vector<int>& real_distances,
+		  const std::optional<std::vector<int>>& reverse_distances) const override {
+    graph = AddRideChain(bus_name, begin(stops), end(stops), begin(real_distances),
+    		stop_db, edge_to_element, std::move(graph), settings);
+    return AddRideChain(bus_name, rbegin(stops), rend(stops), rbegin(*reverse_distances),
+    		stop_db, edge_to_element, std::move(graph), settings);
+  }
 };
 //---------------------Pattern Strategy-----------------------//
 
@@ -279,23 +445,37 @@ public:
 //---------------------Business Logic of Programm----------------//
 class RouteManager {
 public:
-  RouteManager(RoutingSettings settings_): settings(settings_) {}
+  RouteManager(RoutingSettings settings_): route_cache(settings_.route_cache_bytes),
+	  settings(settings_) {}
 
   void SetStopData(std::string_view stop_name, Coords coords,
 		  const std::vector<DistanceToStop>& distances) {
-	stop_db[stop_name].SetCoords(coords);
+	const StopId stop_id = InternStop(stop_name);
+	stop_db[stop_id].SetCoords(coords);
 	for(const DistanceToStop& dist: distances) {
-	  stop_db[stop_name].GetDistance()[dist.stop_name] = dist.distance;
-	  if(!stop_db[dist.stop_name].GetDistance().count(stop_name)) {
-		stop_db[dist.stop_name].GetDistance()[stop_name] = dist.distance;
+	  const StopId to_id = InternStop(dist.stop_name);
+	  stop_db[stop_id].SetDistance(to_id, dist.distance);
+	  if(!stop_db[to_id].GetDistance(stop_id)) {
+		stop_db[to_id].SetDistance(stop_id, dist.distance);
 	  }
 	}
-	stop_db[stop_name].SetVertexId(vertex_counter);
+	stop_db[stop_id].SetVertexId(vertex_counter);
 	++vertex_counter;
   }
 
-  void SetBusData(std::string_view bus_name, const std::vector<std::string>& stops) {
+  void SetBusData(std::string_view bus_name, const std::vector<std::string>& stop_names) {
 	BuildGraphIfNotExists();
+	const auto bus_it = bus_ids.find(bus_name);
+	if(bus_it == bus_ids.end()) {
+	  bus_name = names.Store(bus_name);
+	} else {
+	  bus_name = bus_names[bus_it->second];
+	}
+	std::vector<StopId> stops;
+	stops.reserve(stop_names.size());
+	for(const std::string& stop_name: stop_names) {
+	  stops.push_back(stop_ids.at(stop_name));
+	}
 	BusStats stats;
 	stats.stop_count = strategy->ComputeStopsOnRoute(stops);
 	stats.unique_stop_count = strategy->ComputeUniqueStopsOnRoute(stops);
@@ -303,76 +483,196 @@ public:
 			strategy->ComputeDistancesOnRoute(stops, stop_db);
 	stats.curvature = dist_stats.real_dist / dist_stats.dist;
 	stats.route_distance = dist_stats.real_dist;
-    bus_stats[bus_name] = stats;
+    if(bus_it == bus_ids.end()) {
+      bus_ids.emplace(bus_name, bus_stats.size());
+      bus_names.push_back(bus_name);
+      bus_stats.push_back(stats);
+    } else {
+      bus_stats[bus_it->second] = stats;
+    }
     strategy->FillBusesInStopDB(stops, bus_name, stop_db);
-    graph = strategy->AddEdgesToGraph(bus_name, stops, stop_db, edge_to_element, std::move(graph),
-    		settings, dist_stats.real_distances, dist_stats.reverse_distances);
+    Metrics::ScopedTimer timer("graph_expansion");
+    switch(settings.graph_model) {
+      case GraphModel::STOP_TO_STOP:
+        graph = strategy->AddEdgesToGraph(bus_name, stops, stop_db, edge_to_element, edge_index, std::move(graph),
+        		settings, dist_stats.real_distances, dist_stats.reverse_distances);
+        break;
+      case GraphModel::TRANSIT:
+        graph = strategy->AddRideEdgesToGraph(bus_name, stops, stop_db, edge_to_element, std::move(graph),
+        		settings, dist_stats.real_distances, dist_stats.reverse_distances);
+        break;
+    }
   }
 
   void BuildGraphIfNotExists() {
-    if(!graph) {
-      graph = std::make_unique<Graph::DirectedWeightedGraph
-    		  <double>>(vertex_counter);
+    if(graph) {
+      return;
+    }
+    switch(settings.graph_model) {
+      case GraphModel::STOP_TO_STOP:
+        graph = std::make_unique<Graph::DirectedWeightedGraph
+        		<double>>(vertex_counter);
+        break;
+      case GraphModel::TRANSIT:
+        // Arrival vertices keep the stop vertex ids, boarding vertices follow them
+        // and ride vertices are appended bus by bus.
+        graph = std::make_unique<Graph::DirectedWeightedGraph
+        		<double>>(2 * vertex_counter);
+        for(StopDataBase& stop: stop_db) {
+          if(!stop.HasVertexId()) {
+            continue;
+          }
+          stop.SetBoardingVertexId(vertex_counter + stop.GetVertexId());
+          graph->AddEdge({stop.GetVertexId(), stop.GetBoardingVertexId(),
+        		  static_cast<double>(settings.bus_wait_time)});
+          edge_to_element.push_back({{}, 0, stop.GetName(), 0});
+        }
+        break;
     }
   }
 
+  // The graph is frozen into its CSR layout before the router is built, so the
+  // edge index is dropped and edge_to_element follows the edge renumbering.
+  // Safe to call from several threads: the router is built exactly once.
   void BuildRouterIfNotExists() {
-    if(!router) {
-      router = std::make_unique<Graph::Router<double>>(*graph);
-    }
+    std::call_once(router_once, [this] {
+      Metrics::ScopedTimer timer("router_build");
+      BuildGraphIfNotExists();
+      deduplicated_edge_count = edge_index.GetDuplicateCount();
+      edge_index.Clear();
+      const std::vector<Graph::EdgeId> new_edge_ids = graph->Freeze();
+      std::vector<ElementOfRoute> renumbered_elements(edge_to_element.size());
+      for(Graph::EdgeId edge_id = 0; edge_id < new_edge_ids.size(); ++edge_id) {
+        renumbered_elements[new_edge_ids[edge_id]] = edge_to_element[edge_id];
+      }
+      edge_to_element = std::move(renumbered_elements);
+      switch(settings.router_type) {
+        case RouterType::DIJKSTRA:
+          router = std::make_unique<Graph::DijkstraRouter<double>>(*graph);
+          break;
+        case RouterType::FLOYD_WARSHALL:
+          router = std::make_unique<Graph::Router<double>>(*graph, settings.thread_count);
+          break;
+      }
+    });
   }
 
   void SetStrategy(Strategy* strategy_) {
 	strategy = strategy_;
   }
 
-  std::optional<BusStats> GetBusStats(const std::string& bus_name) const {
-	if(bus_stats.count(bus_name)) {
-	  return bus_stats.at(bus_name);
+  const RoutingSettings& GetRoutingSettings() const {
+	return settings;
+  }
+
+  // Writes the built network, its graph and router to a versioned binary
+  // snapshot, building the router first if needed. Deserialize restores a
+  // manager that answers the same read requests without rebuilding anything;
+  // it throws std::runtime_error if the snapshot is malformed. The graph edges
+  // and the router table are not copied: the manager keeps the snapshot data
+  // and queries them in place, so a snapshot loaded with Load is shared through
+  // the page cache by every process that maps the same file.
+  void Serialize(std::ostream& output);
+  static std::unique_ptr<RouteManager> Deserialize(Serialization::SnapshotData snapshot);
+  static std::unique_ptr<RouteManager> Load(const std::string& path) {
+	return Deserialize(Serialization::SnapshotData::FromFile(path));
+  }
+
+  std::optional<BusStats> GetBusStats(std::string_view bus_name) const {
+	if(auto it = bus_ids.find(bus_name); it != bus_ids.end()) {
+	  return bus_stats[it->second];
 	}
 	return std::nullopt;
   }
 
-  std::optional<std::set<std::string_view>> GetStopStats(const std::string& stop_name) {
-	if(stop_db.count(stop_name)) {
-	  return stop_db[stop_name].GetBuses();
+  std::optional<std::set<std::string_view>> GetStopStats(std::string_view stop_name) const {
+	if(auto it = stop_ids.find(stop_name); it != stop_ids.end()) {
+	  return stop_db[it->second].GetBuses();
 	}
 	return std::nullopt;
   }
 
-  std::optional<RouteStats<double>> GetRouteStats(std::string_view from,
-		  std::string_view to) {
+  using RouteStatsPtr = std::shared_ptr<const RouteStats<double>>;
+  using RouteCache = LruCache<uint64_t, RouteStats<double>>;
+
+  // Returns nullptr if either stop is unknown or there is no route. Results are
+  // shared with the route cache and must not be modified.
+  RouteStatsPtr GetRouteStats(std::string_view from, std::string_view to) {
 	BuildRouterIfNotExists();
-	if(route_db.count({from, to})) {
-	  return route_db[{from, to}];
+	const auto from_it = stop_ids.find(from);
+	const auto to_it = stop_ids.find(to);
+	// A stop named only in road_distances has no vertex and is not found either.
+	if(from_it == stop_ids.end() || to_it == stop_ids.end() ||
+		!stop_db[from_it->second].HasVertexId() || !stop_db[to_it->second].HasVertexId()) {
+	  return nullptr;
 	}
-	auto route_info = router->BuildRoute(stop_db.at(from).GetVertexId(),
-			stop_db.at(to).GetVertexId());
-	if(!route_info) {
-	  return std::nullopt;
+	const uint64_t key = (static_cast<uint64_t>(from_it->second) << 32) | to_it->second;
+	if(RouteStatsPtr cached = route_cache.Get(key)) {
+	  return cached;
 	}
-	RouteStats<double> route_stats;
 	std::vector<ElementOfRoute> elements_of_route;
-	for(size_t idx = 0; idx < route_info->edge_count; ++idx) {
-	  Graph::EdgeId edge_id = router->GetRouteEdge(route_info->id, idx);
-	  elements_of_route.push_back(edge_to_element[edge_id]);
+	std::optional<double> weight;
+	{
+	  Metrics::LatencyTimer timer(route_build_latency);
+	  weight = router->VisitRoute(stop_db[from_it->second].GetVertexId(),
+			  stop_db[to_it->second].GetVertexId(), [&](Graph::EdgeId edge_id) {
+		AppendEdgeToRoute(elements_of_route, edge_to_element[edge_id]);
+	  });
 	}
-	route_stats.elements_of_route = std::move(elements_of_route);
-	route_stats.weight = route_info->weight;
-	route_stats.bus_wait_time = settings.bus_wait_time;
-    route_db[{from, to}] = route_stats;
-    return route_stats;
+	if(!weight) {
+	  return nullptr;
+	}
+	auto route_stats = std::make_shared<RouteStats<double>>();
+	route_stats->elements_of_route = std::move(elements_of_route);
+	route_stats->weight = *weight;
+	route_stats->bus_wait_time = settings.bus_wait_time;
+	const size_t route_bytes = sizeof(RouteStats<double>) +
+		route_stats->elements_of_route.capacity() * sizeof(ElementOfRoute);
+	return route_cache.Put(key, std::move(route_stats), route_bytes);
+  }
+
+  RouteCache::Stats GetRouteCacheStats() const {
+	return route_cache.GetStats();
   }
 
+  // Sets the network size, graph, router table and route cache counters.
+  void RecordMetrics(Metrics::Registry& registry) const;
+
 private:
-  std::unordered_map<std::string_view, BusStats> bus_stats;
-  std::unordered_map<std::string_view, StopDataBase> stop_db;
-  std::unordered_map<std::pair<std::string_view, std::string_view>,
-  	  RouteStats<double> , StringPairHasher> route_db;
+  static constexpr uint32_t SNAPSHOT_MAGIC = 0x42485254; // "TRHB"
+  static constexpr uint32_t SNAPSHOT_VERSION = 5;
+  static constexpr uint32_t NO_ID = static_cast<uint32_t>(-1);
+
+  StopId InternStop(std::string_view stop_name) {
+	if(auto it = stop_ids.find(stop_name); it != stop_ids.end()) {
+	  return it->second;
+	}
+	stop_name = names.Store(stop_name);
+	stop_ids.emplace(stop_name, stop_db.size());
+	stop_db.emplace_back().SetName(stop_name);
+	return stop_db.size() - 1;
+  }
+
+  StringPool names;
+  std::unordered_map<std::string_view, BusId> bus_ids;
+  std::vector<std::string_view> bus_names;
+  std::vector<BusStats> bus_stats;
+  std::unordered_map<std::string_view, StopId> stop_ids;
+  std::vector<StopDataBase> stop_db;
+  // Keyed by (from << 32 | to).
+  RouteCache route_cache;
+  // Router queries of route cache misses, null unless stats are enabled.
+  Metrics::Histogram* route_build_latency = Metrics::Registry::Global().GetHistogram("route_build");
   std::vector<ElementOfRoute> edge_to_element;
+  Graph::EdgeIndex edge_index;
+  // Bus edges that were merged into an existing edge between the same vertices.
+  size_t deduplicated_edge_count = 0;
   Strategy* strategy;
+  // Backs the graph edges and router table of a deserialized manager.
+  Serialization::SnapshotData snapshot;
   GraphHolder graph;
   RouterHolder router;
+  std::once_flag router_once;
   size_t vertex_counter = 0;
   RoutingSettings settings;
 };
@@ -382,4 +682,13 @@ private:
 void TestComputeDistance();
 void TestBusStats();
 void TestStopStats();
+void TestDijkstraRouter();
+void TestTransitGraphModel();
+void TestBlockedFloydWarshall();
+void TestMinPlusKernels();
+void TestEdgeIndex();
+void TestStringPool();
+void TestSnapshot();
+void TestRouteCache();
+void TestRoadDistanceOnlyStop();
 //---------------------Tests-----------------------------------//
@@ -0,0 +1,148 @@
+#pragma once
+
+#include "router.h"
+
+#include <functional>
+#include <memory>
+#include <mutex>
+#include <queue>
+
+namespace Graph {
+
+  // Answers every BuildRoute with a single-source Dijkstra search that stops
+  // as soon as the target vertex is settled. No all-pairs preprocessing is done,
+  // so construction is O(1) and each query costs O(E log V).
+  template <typename Weight>
+  class DijkstraRouter : public RouterBase<Weight> {
+  private:
+    using Graph = DirectedWeightedGraph<Weight>;
+
+  public:
+    // The graph must be frozen.
+    DijkstraRouter(const Graph& graph);
+
+    using typename RouterBase<Weight>::RouteInfo;
+
+    std::optional<RouteInfo> BuildRoute(VertexId from, VertexId to, std::vector<EdgeId>& edges) const override;
+
+  private:
+    const Graph& graph_;
+
+    struct VertexState {
+      std::optional<Weight> weight;
+      std::optional<EdgeId> prev_edge;
+      bool settled = false;
+    };
+
+    // Per-vertex state of one search. It is reused between queries and only the
+    // vertices touched by the previous search are reset.
+    struct SearchState {
+      std::vector<VertexState> vertex_states;
+      std::vector<VertexId> touched_vertices;
+
+      void Reset() {
+        for (const VertexId vertex : touched_vertices) {
+          vertex_states[vertex] = VertexState{};
+        }
+        touched_vertices.clear();
+      }
+
+      VertexState& Touch(VertexId vertex) {
+        if (!vertex_states[vertex].weight) {
+          touched_vertices.push_back(vertex);
+        }
+        return vertex_states[vertex];
+      }
+    };
+
+    // Concurrent queries each take their own search state from this pool.
+    mutable std::mutex free_states_mutex_;
+    mutable std::vector<std::unique_ptr<SearchState>> free_states_;
+
+    std::unique_ptr<SearchState> AcquireSearchState() const {
+      {
+        std::lock_guard<std::mutex> lock(free_states_mutex_);
+        if (!free_states_.empty()) {
+          auto state = std::move(free_states_.back());
+          free_states_.pop_back();
+          return state;
+        }
+      }
+      auto state = std::make_unique<SearchState>();
+      state->vertex_states.resize(graph_.GetVertexCount());
+      return state;
+    }
+
+    void ReleaseSearchState(std::unique_ptr<SearchState> state) const {
+      state->Reset();
+      std::lock_guard<std::mutex> lock(free_states_mutex_);
+      free_states_.push_back(std::move(state));
+    }
+  };
+
+
+  template <typename Weight>
+  DijkstraRouter<Weight>::DijkstraRouter(const Graph& graph)
+      : graph_(graph)
+  {
+    assert(graph.IsFrozen());
+  }
+
+  template <typename Weight>
+  std::optional<typename DijkstraRouter<Weight>::RouteInfo>
+  DijkstraRouter<Weight>::BuildRoute(VertexId from, VertexId to, std::vector<EdgeId>& edges) const {
+    edges.clear();
+    auto search_state = AcquireSearchState();
+    SearchState& search = *search_state;
+
+    using QueueItem = std::pair<Weight, VertexId>;
+    std::priority_queue<QueueItem, std::vector<QueueItem>, std::greater<QueueItem>> queue;
+
+    search.Touch(from).weight = 0;
+    queue.push({0, from});
+
+    while (!queue.empty()) {
+      const auto [weight, vertex] = queue.top();
+      queue.pop();
+      VertexState& state = search.vertex_states[vertex];
+      if (state.settled) {
+        continue;
+      }
+      state.settled = true;
+      if (vertex == to) {
+        break;
+      }
+      const EdgeId edges_end = graph_.GetOutEdgesEnd(vertex);
+      for (EdgeId edge_id = graph_.GetOutEdgesBegin(vertex); edge_id < edges_end; ++edge_id) {
+        assert(graph_.GetEdgeWeight(edge_id) >= 0);
+        const VertexId next_vertex = graph_.GetEdgeTarget(edge_id);
+        const Weight candidate_weight = weight + graph_.GetEdgeWeight(edge_id);
+        const auto& next_weight = search.vertex_states[next_vertex].weight;
+        if (!next_weight || candidate_weight < *next_weight) {
+          VertexState& next_state = search.Touch(next_vertex);
+          next_state.weight = candidate_weight;
+          next_state.prev_edge = edge_id;
+          queue.push({candidate_weight, next_vertex});
+        }
+      }
+    }
+
+    const VertexState& target_state = search.vertex_states[to];
+    if (!target_state.settled) {
+      ReleaseSearchState(std::move(search_state));
+      return std::nullopt;
+    }
+
+    for (std::optional<EdgeId> edge_id = target_state.prev_edge;
+         edge_id;
+         edge_id = search.vertex_states[graph_.GetEdge(*edge_id).from].prev_edge) {
+      edges.push_back(*edge_id);
+    }
+    std::reverse(std::begin(edges), std::end(edges));
+    const Weight weight = *target_state.weight;
+    ReleaseSearchState(std::move(search_state));
+
+    return RouteInfo{weight, edges.size()};
+  }
+
+}
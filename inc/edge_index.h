@@ -0,0 +1,94 @@
+#pragma once
+
+#include "graph.h"
+
+#include <cstdint>
+#include <utility>
+#include <vector>
+
+namespace Graph {
+
+  // Flat open-addressing hash map from a (from, to) vertex pair to the id of the
+  // edge between them. Used while a graph is being built to find an existing
+  // parallel edge in O(1) instead of scanning the incident edges of from.
+  class EdgeIndex {
+  public:
+    // If the pair is already indexed returns its edge id and false, otherwise
+    // stores edge_id for it and returns edge_id and true.
+    std::pair<EdgeId, bool> Emplace(VertexId from, VertexId to, EdgeId edge_id) {
+      if (2 * (size_ + 1) > slots_.size()) {
+        Rehash(slots_.empty() ? 16 : 2 * slots_.size());
+      }
+      const uint64_t key = MakeKey(from, to);
+      Slot& slot = FindSlot(key);
+      if (slot.key == key) {
+        ++duplicate_count_;
+        return {slot.edge_id, false};
+      }
+      slot = {key, edge_id};
+      ++size_;
+      return {edge_id, true};
+    }
+
+    size_t Size() const {
+      return size_;
+    }
+
+    // Number of Emplace calls that found their pair already indexed.
+    size_t GetDuplicateCount() const {
+      return duplicate_count_;
+    }
+
+    // Releases all the memory held by the index. The duplicate count is kept.
+    void Clear() {
+      std::vector<Slot>().swap(slots_);
+      size_ = 0;
+    }
+
+  private:
+    static constexpr uint64_t EMPTY_KEY = UINT64_MAX;
+
+    struct Slot {
+      uint64_t key = EMPTY_KEY;
+      EdgeId edge_id = 0;
+    };
+
+    static uint64_t MakeKey(VertexId from, VertexId to) {
+      return (static_cast<uint64_t>(from) << 32) | static_cast<uint32_t>(to);
+    }
+
+    // Fibonacci hashing: the high bits of the product are well mixed.
+    size_t GetHomeSlot(uint64_t key) const {
+      return (key * 0x9E3779B97F4A7C15ull) >> (64 - capacity_bits_);
+    }
+
+    Slot& FindSlot(uint64_t key) {
+      const size_t mask = slots_.size() - 1;
+      for (size_t idx = GetHomeSlot(key); ; idx = (idx + 1) & mask) {
+        if (slots_[idx].key == key || slots_[idx].key == EMPTY_KEY) {
+          return slots_[idx];
+        }
+      }
+    }
+
+    void Rehash(size_t capacity) {
+      std::vector<Slot> old_slots(capacity);
+      old_slots.swap(slots_);
+      capacity_bits_ = 0;
+      while ((size_t{1} << capacity_bits_) < capacity) {
+        ++capacity_bits_;
+      }
+      for (const Slot& slot : old_slots) {
+        if (slot.key != EMPTY_KEY) {
+          FindSlot(slot.key) = slot;
+        }
+      }
+    }
+
+    std::vector<Slot> slots_;
+    size_t size_ = 0;
+    size_t duplicate_count_ = 0;
+    unsigned capacity_bits_ = 0;
+  };
+
+}
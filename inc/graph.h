@@ -1,7 +1,9 @@
 #pragma once
 
+#include <cassert>
 #include <cstdlib>
 #include <deque>
+#include <utility>
 #include <vector>
 
 template <typename It>
@@ -30,6 +32,11 @@ namespace Graph {
     Weight weight;
   };
 
+  // Edges are added to per-vertex incidence lists while the graph is built.
+  // Freeze then switches it to the compressed sparse row (CSR) layout: edges are
+  // renumbered so that the edges leaving a vertex have consecutive ids, and their
+  // targets and weights are copied to two contiguous arrays that traversals scan
+  // without touching the full edges.
   template <typename Weight>
   class DirectedWeightedGraph {
   private:
@@ -38,26 +45,87 @@ namespace Graph {
 
   public:
     DirectedWeightedGraph(size_t vertex_count);
+    // Frozen graph over an external edge array sorted by source vertex, e.g. one
+    // in a memory-mapped file, which must outlive the graph. Edges keep their
+    // indices as ids.
+    DirectedWeightedGraph(size_t vertex_count, const Edge<Weight>* edges, size_t edge_count);
+    // edge_data_ may point into edges_, so copies are not allowed.
+    DirectedWeightedGraph(const DirectedWeightedGraph&) = delete;
+    DirectedWeightedGraph& operator=(const DirectedWeightedGraph&) = delete;
+    DirectedWeightedGraph(DirectedWeightedGraph&&) = default;
+    DirectedWeightedGraph& operator=(DirectedWeightedGraph&&) = default;
+    VertexId AddVertex();
     EdgeId AddEdge(const Edge<Weight>& edge);
 
     size_t GetVertexCount() const;
     size_t GetEdgeCount() const;
     const Edge<Weight>& GetEdge(EdgeId edge_id) const;
+    // Not frozen graphs only; the CSR arrays would not see the change.
     Edge<Weight>& GetEdge(EdgeId edge_id);
+    // Not frozen graphs only.
     IncidentEdgesRange GetIncidentEdges(VertexId vertex) const;
 
+    // Sorts the edges by source vertex, keeping the order of the edges of each
+    // vertex, and releases the incidence lists. No edges may be added or changed
+    // afterwards. Returns the new id of every old edge id.
+    std::vector<EdgeId> Freeze();
+    bool IsFrozen() const;
+
+    // Frozen graphs only. The edges leaving vertex have ids in
+    // [GetOutEdgesBegin(vertex), GetOutEdgesEnd(vertex)).
+    EdgeId GetOutEdgesBegin(VertexId vertex) const;
+    EdgeId GetOutEdgesEnd(VertexId vertex) const;
+    VertexId GetEdgeTarget(EdgeId edge_id) const;
+    Weight GetEdgeWeight(EdgeId edge_id) const;
+
   private:
+    void BuildOutEdges();
+
     std::vector<Edge<Weight>> edges_;
+    // Either edges_.data() or the external edge array.
+    const Edge<Weight>* edge_data_ = nullptr;
+    size_t edge_count_ = 0;
+    size_t vertex_count_;
     std::vector<IncidenceList> incidence_lists_;
+
+    bool frozen_ = false;
+    std::vector<EdgeId> out_offsets_;  // vertex_count + 1
+    std::vector<VertexId> out_targets_;
+    std::vector<Weight> out_weights_;
   };
 
 
   template <typename Weight>
-  DirectedWeightedGraph<Weight>::DirectedWeightedGraph(size_t vertex_count) : incidence_lists_(vertex_count) {}
+  DirectedWeightedGraph<Weight>::DirectedWeightedGraph(size_t vertex_count)
+      : vertex_count_(vertex_count), incidence_lists_(vertex_count) {}
+
+  template <typename Weight>
+  DirectedWeightedGraph<Weight>::DirectedWeightedGraph(size_t vertex_count, const Edge<Weight>* edges, size_t edge_count)
+      : edge_data_(edges), edge_count_(edge_count), vertex_count_(vertex_count) {
+    out_offsets_.assign(vertex_count_ + 1, 0);
+    for (EdgeId id = 0; id < edge_count_; ++id) {
+      assert(id == 0 || edge_data_[id - 1].from <= edge_data_[id].from);
+      ++out_offsets_[edge_data_[id].from + 1];
+    }
+    for (VertexId vertex = 0; vertex < vertex_count_; ++vertex) {
+      out_offsets_[vertex + 1] += out_offsets_[vertex];
+    }
+    BuildOutEdges();
+  }
+
+  template <typename Weight>
+  VertexId DirectedWeightedGraph<Weight>::AddVertex() {
+    assert(!frozen_);
+    incidence_lists_.emplace_back();
+    return vertex_count_++;
+  }
 
   template <typename Weight>
   EdgeId DirectedWeightedGraph<Weight>::AddEdge(const Edge<Weight>& edge) {
+    assert(!frozen_);
     edges_.push_back(edge);
+    edge_data_ = edges_.data();
+    edge_count_ = edges_.size();
     const EdgeId id = edges_.size() - 1;
     incidence_lists_[edge.from].push_back(id);
     return id;
@@ -65,28 +133,87 @@ namespace Graph {
 
   template <typename Weight>
   size_t DirectedWeightedGraph<Weight>::GetVertexCount() const {
-    return incidence_lists_.size();
+    return vertex_count_;
   }
 
   template <typename Weight>
   size_t DirectedWeightedGraph<Weight>::GetEdgeCount() const {
-    return edges_.size();
+    return edge_count_;
   }
 
   template <typename Weight>
   const Edge<Weight>& DirectedWeightedGraph<Weight>::GetEdge(EdgeId edge_id) const {
-    return edges_[edge_id];
+    return edge_data_[edge_id];
   }
 
   template <typename Weight>
   Edge<Weight>& DirectedWeightedGraph<Weight>::GetEdge(EdgeId edge_id) {
+    assert(!frozen_);
     return edges_[edge_id];
   }
 
   template <typename Weight>
   typename DirectedWeightedGraph<Weight>::IncidentEdgesRange
   DirectedWeightedGraph<Weight>::GetIncidentEdges(VertexId vertex) const {
+    assert(!frozen_);
     const auto& edges = incidence_lists_[vertex];
     return {std::begin(edges), std::end(edges)};
   }
+
+  template <typename Weight>
+  std::vector<EdgeId> DirectedWeightedGraph<Weight>::Freeze() {
+    assert(!frozen_);
+    std::vector<EdgeId> new_ids(edge_count_);
+    std::vector<Edge<Weight>> sorted_edges;
+    sorted_edges.reserve(edge_count_);
+    out_offsets_.assign(vertex_count_ + 1, 0);
+    for (VertexId vertex = 0; vertex < vertex_count_; ++vertex) {
+      for (const EdgeId id : incidence_lists_[vertex]) {
+        new_ids[id] = sorted_edges.size();
+        sorted_edges.push_back(edges_[id]);
+      }
+      out_offsets_[vertex + 1] = sorted_edges.size();
+    }
+    edges_ = std::move(sorted_edges);
+    edge_data_ = edges_.data();
+    std::vector<IncidenceList>().swap(incidence_lists_);
+    BuildOutEdges();
+    return new_ids;
+  }
+
+  template <typename Weight>
+  void DirectedWeightedGraph<Weight>::BuildOutEdges() {
+    out_targets_.resize(edge_count_);
+    out_weights_.resize(edge_count_);
+    for (EdgeId id = 0; id < edge_count_; ++id) {
+      out_targets_[id] = edge_data_[id].to;
+      out_weights_[id] = edge_data_[id].weight;
+    }
+    frozen_ = true;
+  }
+
+  template <typename Weight>
+  bool DirectedWeightedGraph<Weight>::IsFrozen() const {
+    return frozen_;
+  }
+
+  template <typename Weight>
+  EdgeId DirectedWeightedGraph<Weight>::GetOutEdgesBegin(VertexId vertex) const {
+    return out_offsets_[vertex];
+  }
+
+  template <typename Weight>
+  EdgeId DirectedWeightedGraph<Weight>::GetOutEdgesEnd(VertexId vertex) const {
+    return out_offsets_[vertex + 1];
+  }
+
+  template <typename Weight>
+  VertexId DirectedWeightedGraph<Weight>::GetEdgeTarget(EdgeId edge_id) const {
+    return out_targets_[edge_id];
+  }
+
+  template <typename Weight>
+  Weight DirectedWeightedGraph<Weight>::GetEdgeWeight(EdgeId edge_id) const {
+    return out_weights_[edge_id];
+  }
 }
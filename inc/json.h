@@ -1,11 +1,18 @@
 #pragma once
 
+#include <cstddef>
+#include <cstdint>
 #include <istream>
 #include <map>
+#include <memory>
+#include <stdexcept>
+#include <type_traits>
 #include <string>
+#include <string_view>
 #include <variant>
 #include <vector>
 #include <sstream>
+#include <ostream>
 
 namespace Json {
 
@@ -59,48 +66,8 @@ namespace Json {
 	  return std::holds_alternative<bool>(*this);
 	}
 
-	std::string FromJsonToString() const{
-		std::ostringstream os;
-		if(IsArray()){
-			os << "[\n" ;
-			for(auto it = begin(AsArray()); it != end(AsArray()); ++it) {
-				if(it != prev(end(AsArray()))) {
-					os << it->FromJsonToString() << ",\n";
-				} else {
-					os << it->FromJsonToString() << "\n";
-				}
-			}
-			std::string out = os.str();
-			out.push_back(']');
-			return out;
-		} else if (IsMap()) {
-			os << "{\n" ;
-			for(auto it = begin(AsMap()); it != end(AsMap()); ++it) {
-				if(it != prev(end(AsMap()))) {
-					os << '"' << it->first << "\": " << it->second.FromJsonToString() << ",\n";
-				} else {
-					os << '"' << it->first << "\": " << it->second.FromJsonToString() << "\n";
-				}
-			}
-			std::string out = os.str();
-			out.append("}");
-			return out;
-		} else if (IsString()) {
-			os << '"' << AsString() << '"';
-			return os.str();
-		} else if (IsInt()) {
-			os << AsInt();
-			return os.str();
-		} else if (IsDouble()) {
-			os << AsDouble();
-			return os.str();
-		} else if (IsBool()) {
-			os << std::boolalpha << AsBool();
-			return os.str();
-		} else {
-			return "";
-		}
-	}
+	// Kept for callers that need the text in memory; prefer Writer for output.
+	std::string FromJsonToString() const;
 
   };
 
@@ -114,6 +81,370 @@ namespace Json {
     Node root;
   };
 
+  // Monotonic allocator behind a CompactDocument. Everything is carved out of
+  // large blocks and released at once with the arena, so only trivially
+  // destructible data may live here.
+  class Arena {
+  public:
+    static constexpr size_t BLOCK_SIZE = 1 << 16;
+
+    template <typename T>
+    T* AllocateArray(size_t count) {
+      static_assert(std::is_trivially_destructible_v<T> && alignof(T) <= alignof(std::max_align_t));
+      return static_cast<T*>(Allocate(count * sizeof(T), alignof(T)));
+    }
+
+    std::string_view StoreString(std::string_view str);
+
+    // Makes all the memory reusable; views and nodes handed out so far dangle.
+    // Regular blocks are kept for the next allocations.
+    void Reset();
+
+    size_t GetAllocatedBytes() const;
+
+  private:
+    void* Allocate(size_t bytes, size_t alignment);
+
+    std::vector<std::unique_ptr<char[]>> blocks;
+    std::vector<std::unique_ptr<char[]>> large_blocks;
+    size_t current_block = 0;
+    size_t block_used = BLOCK_SIZE;
+    size_t allocated_bytes = 0;
+  };
+
+  struct CompactMember;
+  class CompactArray;
+  class CompactObject;
+
+  // Read-only DOM node that fits in 16 bytes. Arrays and objects point to their
+  // items in an Arena, objects keep their members sorted by key, and strings are
+  // views into the parsed text or, when they had escapes, into the arena. The
+  // accessors mirror Node's, so AsMap().at(...) reads the same for both; a
+  // wrong-type access throws std::bad_variant_access like Node's does.
+  class CompactNode {
+  public:
+    enum class Type : uint8_t {
+      ARRAY,
+      OBJECT,
+      INT,
+      STRING,
+      DOUBLE,
+      BOOL,
+    };
+
+    // An empty array, like a default Node.
+    CompactNode() : type(Type::ARRAY), size(0), items(nullptr) {}
+
+    static CompactNode MakeArray(const CompactNode* items, uint32_t size);
+    static CompactNode MakeObject(const CompactMember* members, uint32_t size);
+    static CompactNode MakeString(std::string_view str);
+    static CompactNode MakeInt(int value);
+    static CompactNode MakeDouble(double value);
+    static CompactNode MakeBool(bool value);
+
+    CompactArray AsArray() const;
+    CompactObject AsMap() const;
+    int AsInt() const {
+      Check(Type::INT);
+      return int_value;
+    }
+    double AsDouble() const {
+      if (type == Type::DOUBLE) {
+        return double_value;
+      }
+      return AsInt();
+    }
+    std::string_view AsString() const {
+      Check(Type::STRING);
+      return {chars, size};
+    }
+    bool AsBool() const {
+      Check(Type::BOOL);
+      return bool_value;
+    }
+
+    bool IsArray() const {
+      return type == Type::ARRAY;
+    }
+    bool IsMap() const {
+      return type == Type::OBJECT;
+    }
+    bool IsInt() const {
+      return type == Type::INT;
+    }
+    bool IsDouble() const {
+      return type == Type::DOUBLE;
+    }
+    bool IsString() const {
+      return type == Type::STRING;
+    }
+    bool IsBool() const {
+      return type == Type::BOOL;
+    }
+
+  private:
+    void Check(Type expected) const {
+      if (type != expected) {
+        throw std::bad_variant_access();
+      }
+    }
+
+    Type type;
+    // Item count of an array or object, length of a string.
+    uint32_t size;
+    union {
+      const CompactNode* items;
+      const CompactMember* members;
+      const char* chars;
+      int int_value;
+      double double_value;
+      bool bool_value;
+    };
+  };
+
+  struct CompactMember {
+    std::string_view key;
+    CompactNode value;
+  };
+
+  class CompactArray {
+  public:
+    CompactArray(const CompactNode* items, size_t size) : items(items), item_count(size) {}
+
+    const CompactNode* begin() const {
+      return items;
+    }
+    const CompactNode* end() const {
+      return items + item_count;
+    }
+    size_t size() const {
+      return item_count;
+    }
+    bool empty() const {
+      return item_count == 0;
+    }
+    const CompactNode& operator[](size_t index) const {
+      return items[index];
+    }
+    const CompactNode& at(size_t index) const {
+      if (index >= item_count) {
+        throw std::out_of_range("JSON array index out of range");
+      }
+      return items[index];
+    }
+
+  private:
+    const CompactNode* items;
+    size_t item_count;
+  };
+
+  // Members are sorted by key and unique, so lookups are binary searches and
+  // iteration goes in the same order as over a Node's std::map.
+  class CompactObject {
+  public:
+    CompactObject(const CompactMember* members, size_t size) : members(members), member_count(size) {}
+
+    const CompactMember* begin() const {
+      return members;
+    }
+    const CompactMember* end() const {
+      return members + member_count;
+    }
+    size_t size() const {
+      return member_count;
+    }
+    bool empty() const {
+      return member_count == 0;
+    }
+
+    // Returns end() if there is no such key.
+    const CompactMember* find(std::string_view key) const;
+    size_t count(std::string_view key) const {
+      return find(key) != end();
+    }
+    const CompactNode& at(std::string_view key) const {
+      const CompactMember* member = find(key);
+      if (member == end()) {
+        throw std::out_of_range("JSON object has no key " + std::string(key));
+      }
+      return member->value;
+    }
+
+  private:
+    const CompactMember* members;
+    size_t member_count;
+  };
+
+  inline CompactArray CompactNode::AsArray() const {
+    Check(Type::ARRAY);
+    return {items, size};
+  }
+
+  inline CompactObject CompactNode::AsMap() const {
+    Check(Type::OBJECT);
+    return {members, size};
+  }
+
+  // A CompactNode tree together with the arena holding it. Strings that were not
+  // escaped point into the parsed text, which must outlive the document unless
+  // it was loaded from a stream.
+  class CompactDocument {
+  public:
+    CompactDocument() = default;
+    CompactDocument(std::unique_ptr<Arena> arena, CompactNode root);
+
+    const CompactNode& GetRoot() const;
+
+    size_t GetArenaBytes() const;
+
+  private:
+    std::unique_ptr<Arena> arena;
+    CompactNode root;
+  };
+
+  // The whole input text kept in one buffer: memory-mapped when the source is a
+  // regular file, read into memory otherwise (pipes, terminals, streams).
+  class InputBuffer {
+  public:
+    static InputBuffer FromFile(const std::string& path);
+    static InputBuffer FromFileDescriptor(int fd);
+    static InputBuffer FromStream(std::istream& input);
+
+    InputBuffer(InputBuffer&& other);
+    InputBuffer& operator=(InputBuffer&& other);
+    ~InputBuffer();
+
+    std::string_view GetText() const;
+
+  private:
+    InputBuffer() = default;
+    void Unmap();
+
+    void* mapped_data = nullptr;
+    size_t mapped_size = 0;
+    std::string content;
+  };
+
+  // Hand-written scanner over an in-memory JSON text. Strings without escapes
+  // are scanned as views into the text and numbers are converted with
+  // std::from_chars; only the resulting Node copies the data.
+  class Parser {
+  public:
+    explicit Parser(std::string_view text);
+
+    Node ParseNode();
+    // Parses one value into arena. Scratch stacks of the parser are reused, so
+    // parsing many values with one parser allocates only in the arena.
+    CompactNode ParseCompactNode(Arena& arena);
+    CompactDocument ParseCompactDocument();
+
+    // Low-level access used to walk a document piece by piece. The per-token
+    // calls are defined here so that readers in other files can inline them.
+    void SkipSpaces() {
+      while (pos < text.size() && IsSpace(text[pos])) {
+        ++pos;
+      }
+    }
+    bool AtEnd();
+    char Peek() {
+      SkipSpaces();
+      if (pos == text.size()) {
+        Fail("unexpected end of input");
+      }
+      return text[pos];
+    }
+    void Expect(char c) {
+      if (Peek() != c) {
+        Fail(std::string("expected '") + c + "'");
+      }
+      ++pos;
+    }
+    // Consumes c if it is the next non-space character.
+    bool TryConsume(char c) {
+      if (Peek() == c) {
+        ++pos;
+        return true;
+      }
+      return false;
+    }
+    // Returns a view into the text, or into scratch when the string has escapes.
+    std::string_view ParseString(std::string& scratch);
+    // Skips one value without building it.
+    void SkipValue();
+    // Scalars come back as a Node, which holds them without allocating.
+    Node ParseNumber();
+    Node ParseBool();
+    size_t GetPosition() const;
+
+  private:
+    Node ParseArray();
+    Node ParseDict();
+    std::string_view ParseCompactString(Arena& arena);
+    void SkipString();
+    // The four whitespace characters JSON allows between tokens.
+    static bool IsSpace(char c) {
+      return c == ' ' || c == '\n' || c == '\r' || c == '\t';
+    }
+    [[noreturn]] void Fail(const std::string& message) const;
+
+    std::string_view text;
+    size_t pos = 0;
+    std::string string_scratch;
+    std::vector<CompactNode> node_stack;
+    std::vector<CompactMember> member_stack;
+  };
+
+  // Serializes JSON into a reusable buffer that is flushed to the output stream
+  // in large chunks, so the text of a document is never held in memory whole.
+  // Doubles are printed like the stream would print them (general format with
+  // the stream's precision), but without going through the stream.
+  class Writer {
+  public:
+    explicit Writer(std::ostream& output, size_t flush_threshold = 1 << 16);
+    ~Writer();
+
+    Writer(const Writer&) = delete;
+    Writer& operator=(const Writer&) = delete;
+
+    void Write(const Node& node);
+
+    void BeginArray();
+    void EndArray();
+    void BeginObject();
+    void Key(std::string_view key);
+    void EndObject();
+
+    void Value(int value);
+    void Value(double value);
+    void Value(std::string_view value);
+    void Value(const char* value) {
+      Value(std::string_view(value));
+    }
+    void Value(bool value);
+
+    void Flush();
+
+  private:
+    // Writes the separator owed before the next array element or object key.
+    void BeginItem();
+    void EndScope(char bracket);
+    void FlushIfFull();
+
+    std::ostream& output;
+    size_t flush_threshold;
+    int precision;
+    std::string buffer;
+    // One entry per open array or object: whether it has items yet.
+    std::vector<bool> scope_has_items;
+    bool after_key = false;
+  };
+
+  Document Load(std::string_view text);
   Document Load(std::istream& input);
 
+  // The document keeps views into text, which must outlive it.
+  CompactDocument LoadCompact(std::string_view text);
+  // The text is copied into the document's arena first.
+  CompactDocument LoadCompact(std::istream& input);
+
 }
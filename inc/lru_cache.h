@@ -0,0 +1,94 @@
+#pragma once
+
+#include <cstddef>
+#include <functional>
+#include <list>
+#include <memory>
+#include <mutex>
+#include <unordered_map>
+#include <utility>
+
+// Thread-safe least-recently-used cache of immutable values bounded by a byte
+// budget. Values are handed out as shared_ptr<const Value>, so a hit copies no
+// data and an entry evicted while in use stays alive until its last reader
+// drops it. The caller tells Put how many bytes a value takes.
+template <typename Key, typename Value, typename Hasher = std::hash<Key>>
+class LruCache {
+public:
+  using ValuePtr = std::shared_ptr<const Value>;
+
+  struct Stats {
+    size_t hits = 0;
+    size_t misses = 0;
+    size_t evictions = 0;
+    size_t entry_count = 0;
+    size_t size_bytes = 0;
+  };
+
+  // byte_budget == 0 disables caching.
+  explicit LruCache(size_t byte_budget) : byte_budget_(byte_budget) {}
+
+  // Returns nullptr on a miss.
+  ValuePtr Get(const Key& key) {
+    std::lock_guard<std::mutex> lock(mutex_);
+    const auto it = index_.find(key);
+    if (it == index_.end()) {
+      ++stats_.misses;
+      return nullptr;
+    }
+    ++stats_.hits;
+    entries_.splice(entries_.begin(), entries_, it->second);
+    return it->second->value;
+  }
+
+  // Stores value unless the key is already cached, evicting the least recently
+  // used entries to stay within the budget. Returns the cached value.
+  ValuePtr Put(const Key& key, ValuePtr value, size_t value_bytes) {
+    const size_t entry_bytes = value_bytes + ENTRY_OVERHEAD;
+    std::lock_guard<std::mutex> lock(mutex_);
+    if (const auto it = index_.find(key); it != index_.end()) {
+      return it->second->value;
+    }
+    if (entry_bytes > byte_budget_) {
+      return value;
+    }
+    while (stats_.size_bytes + entry_bytes > byte_budget_) {
+      Entry& victim = entries_.back();
+      stats_.size_bytes -= victim.size_bytes;
+      index_.erase(victim.key);
+      entries_.pop_back();
+      ++stats_.evictions;
+    }
+    entries_.push_front({key, value, entry_bytes});
+    index_.emplace(key, entries_.begin());
+    stats_.size_bytes += entry_bytes;
+    return value;
+  }
+
+  Stats GetStats() const {
+    std::lock_guard<std::mutex> lock(mutex_);
+    Stats stats = stats_;
+    stats.entry_count = entries_.size();
+    return stats;
+  }
+
+private:
+  struct Entry {
+    Key key;
+    ValuePtr value;
+    size_t size_bytes;
+  };
+  using EntryList = std::list<Entry>;
+
+  // Rough cost of the list node, the index node and the shared_ptr control
+  // block that come with every entry.
+  static constexpr size_t ENTRY_OVERHEAD = sizeof(Entry) + 2 * sizeof(void*)
+      + sizeof(Key) + sizeof(typename EntryList::iterator) + 3 * sizeof(void*)
+      + 4 * sizeof(void*);
+
+  const size_t byte_budget_;
+  mutable std::mutex mutex_;
+  EntryList entries_;
+  std::unordered_map<Key, typename EntryList::iterator, Hasher> index_;
+  Stats stats_;
+};
@@ -0,0 +1,160 @@
+#pragma once
+
+#include <array>
+#include <atomic>
+#include <chrono>
+#include <cstdint>
+#include <map>
+#include <mutex>
+#include <ostream>
+#include <string>
+#include <string_view>
+
+#include "trace.h"
+
+// Built-in instrumentation: wall time spent in named phases, named counters and
+// latency histograms, written out as one JSON report at the end of a run. A
+// disabled registry records nothing, so a ScopedTimer or a LatencyTimer then
+// costs a single branch.
+namespace Metrics {
+
+  using Clock = std::chrono::steady_clock;
+
+  // Log-bucketed latency histogram in the style of HdrHistogram: every power of
+  // two nanoseconds is split into SUB_BUCKET_COUNT linear buckets, so a reported
+  // percentile is within about 3% of the exact one. Recording is lock-free and
+  // may happen from several threads at once.
+  class Histogram {
+  public:
+    Histogram() {
+      Reset();
+    }
+
+    void Record(Clock::duration elapsed);
+
+    uint64_t GetCount() const {
+      return count_.load(std::memory_order_relaxed);
+    }
+
+    Clock::duration GetMax() const {
+      return std::chrono::nanoseconds(max_.load(std::memory_order_relaxed));
+    }
+
+    // Upper bound of the bucket holding the given quantile, at most the maximum.
+    // Zero for an empty histogram.
+    Clock::duration GetPercentile(double quantile) const;
+
+    void Reset();
+
+  private:
+    static constexpr unsigned SUB_BUCKET_BITS = 5;
+    static constexpr size_t SUB_BUCKET_COUNT = size_t{1} << SUB_BUCKET_BITS;
+    // Longer latencies (about three days) land in the last bucket.
+    static constexpr unsigned MAX_VALUE_BITS = 48;
+    static constexpr size_t BUCKET_COUNT = (MAX_VALUE_BITS - SUB_BUCKET_BITS + 1) * SUB_BUCKET_COUNT;
+
+    static size_t GetBucketIndex(uint64_t nanoseconds);
+    static uint64_t GetBucketUpperBound(size_t index);
+
+    std::array<std::atomic<uint64_t>, BUCKET_COUNT> buckets_;
+    std::atomic<uint64_t> count_;
+    std::atomic<uint64_t> max_;
+  };
+
+  class Registry {
+  public:
+    // An empty destination reports to stderr.
+    explicit Registry(bool enabled, std::string destination = {})
+        : enabled_(enabled), destination_(std::move(destination)) {}
+
+    // Process-wide registry. It is enabled when the TRANSPORT_STATS environment
+    // variable is set: "-" or an empty value reports to stderr, anything else
+    // names the report file.
+    static Registry& Global();
+
+    bool IsEnabled() const {
+      return enabled_;
+    }
+
+    // Phases may nest and may run more than once; every call adds to the total.
+    void AddTime(std::string_view phase, Clock::duration elapsed);
+    void SetCounter(std::string_view counter, uint64_t value);
+    // Returns the named histogram, creating it on first use, or nullptr if the
+    // registry is disabled. The histogram lives as long as the registry, so hot
+    // paths look it up once and record through the pointer.
+    Histogram* GetHistogram(std::string_view name);
+    // Forgets every phase and counter recorded so far and empties the histograms.
+    void Clear();
+
+    void WriteReport(std::ostream& output) const;
+    // Writes the report to the destination given at construction. Does nothing
+    // if the registry is disabled.
+    void Report() const;
+
+  private:
+    struct PhaseTime {
+      Clock::duration total = Clock::duration::zero();
+      uint64_t calls = 0;
+    };
+
+    const bool enabled_;
+    const std::string destination_;
+    mutable std::mutex mutex_;
+    std::map<std::string, PhaseTime, std::less<>> phases_;
+    std::map<std::string, uint64_t, std::less<>> counters_;
+    std::map<std::string, Histogram, std::less<>> histograms_;
+  };
+
+  // Adds the lifetime of the timer to a phase of the registry and records it as
+  // a span of the global trace.
+  class ScopedTimer {
+  public:
+    ScopedTimer(Registry& registry, std::string_view phase)
+        : registry_(registry), phase_(phase), span_(phase, "phase") {
+      if (registry_.IsEnabled()) {
+        start_ = Clock::now();
+      }
+    }
+
+    explicit ScopedTimer(std::string_view phase) : ScopedTimer(Registry::Global(), phase) {}
+
+    ~ScopedTimer() {
+      if (registry_.IsEnabled()) {
+        registry_.AddTime(phase_, Clock::now() - start_);
+      }
+    }
+
+    ScopedTimer(const ScopedTimer&) = delete;
+    ScopedTimer& operator=(const ScopedTimer&) = delete;
+
+  private:
+    Registry& registry_;
+    std::string_view phase_;
+    Clock::time_point start_;
+    Trace::Span span_;
+  };
+
+  // Records its lifetime into a histogram; a null histogram records nothing.
+  class LatencyTimer {
+  public:
+    explicit LatencyTimer(Histogram* histogram) : histogram_(histogram) {
+      if (histogram_) {
+        start_ = Clock::now();
+      }
+    }
+
+    ~LatencyTimer() {
+      if (histogram_) {
+        histogram_->Record(Clock::now() - start_);
+      }
+    }
+
+    LatencyTimer(const LatencyTimer&) = delete;
+    LatencyTimer& operator=(const LatencyTimer&) = delete;
+
+  private:
+    Histogram* histogram_;
+    Clock::time_point start_;
+  };
+
+}
@@ -0,0 +1,98 @@
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+
+#if defined(__x86_64__) || defined(__i386__)
+#include <immintrin.h>
+#define GRAPH_MIN_PLUS_X86
+#endif
+
+namespace Graph {
+
+  // Min-plus row update used by the Floyd–Warshall router:
+  //   weights[i] = min(weights[i], weight_from + weights_through[i])
+  // with prev_edges[i] taken from prev_edges_through[i] where the candidate is
+  // strictly smaller. Missing routes are +inf, so no per-element checks are
+  // needed and every implementation gives bit-identical results.
+  using MinPlusRowKernel = void (*)(float weight_from, size_t count,
+                                    const float* weights_through, const uint32_t* prev_edges_through,
+                                    float* weights, uint32_t* prev_edges);
+
+  inline void MinPlusRowScalar(float weight_from, size_t count,
+                               const float* weights_through, const uint32_t* prev_edges_through,
+                               float* weights, uint32_t* prev_edges) {
+    for (size_t idx = 0; idx < count; ++idx) {
+      const float candidate_weight = weight_from + weights_through[idx];
+      if (candidate_weight < weights[idx]) {
+        weights[idx] = candidate_weight;
+        prev_edges[idx] = prev_edges_through[idx];
+      }
+    }
+  }
+
+#ifdef GRAPH_MIN_PLUS_X86
+  __attribute__((target("sse2")))
+  inline void MinPlusRowSse2(float weight_from, size_t count,
+                             const float* weights_through, const uint32_t* prev_edges_through,
+                             float* weights, uint32_t* prev_edges) {
+    const __m128 from = _mm_set1_ps(weight_from);
+    size_t idx = 0;
+    for (; idx + 4 <= count; idx += 4) {
+      const __m128 candidate = _mm_add_ps(from, _mm_loadu_ps(weights_through + idx));
+      const __m128 current = _mm_loadu_ps(weights + idx);
+      const __m128 better = _mm_cmplt_ps(candidate, current);
+      _mm_storeu_ps(weights + idx,
+                    _mm_or_ps(_mm_and_ps(better, candidate), _mm_andnot_ps(better, current)));
+
+      const __m128i mask = _mm_castps_si128(better);
+      const __m128i edges_through = _mm_loadu_si128(reinterpret_cast<const __m128i*>(prev_edges_through + idx));
+      const __m128i edges = _mm_loadu_si128(reinterpret_cast<const __m128i*>(prev_edges + idx));
+      _mm_storeu_si128(reinterpret_cast<__m128i*>(prev_edges + idx),
+                       _mm_or_si128(_mm_and_si128(mask, edges_through), _mm_andnot_si128(mask, edges)));
+    }
+    MinPlusRowScalar(weight_from, count - idx, weights_through + idx, prev_edges_through + idx,
+                     weights + idx, prev_edges + idx);
+  }
+
+  __attribute__((target("avx2")))
+  inline void MinPlusRowAvx2(float weight_from, size_t count,
+                             const float* weights_through, const uint32_t* prev_edges_through,
+                             float* weights, uint32_t* prev_edges) {
+    const __m256 from = _mm256_set1_ps(weight_from);
+    size_t idx = 0;
+    for (; idx + 8 <= count; idx += 8) {
+      const __m256 candidate = _mm256_add_ps(from, _mm256_loadu_ps(weights_through + idx));
+      const __m256 current = _mm256_loadu_ps(weights + idx);
+      const __m256 better = _mm256_cmp_ps(candidate, current, _CMP_LT_OQ);
+      _mm256_storeu_ps(weights + idx, _mm256_blendv_ps(current, candidate, better));
+
+      const __m256 edges_through = _mm256_castsi256_ps(
+          _mm256_loadu_si256(reinterpret_cast<const __m256i*>(prev_edges_through + idx)));
+      const __m256 edges = _mm256_castsi256_ps(
+          _mm256_loadu_si256(reinterpret_cast<const __m256i*>(prev_edges + idx)));
+      _mm256_storeu_si256(reinterpret_cast<__m256i*>(prev_edges + idx),
+                          _mm256_castps_si256(_mm256_blendv_ps(edges, edges_through, better)));
+    }
+    MinPlusRowSse2(weight_from, count - idx, weights_through + idx, prev_edges_through + idx,
+                   weights + idx, prev_edges + idx);
+  }
+#endif
+
+  inline MinPlusRowKernel SelectMinPlusRowKernel() {
+#ifdef GRAPH_MIN_PLUS_X86
+    __builtin_cpu_init();
+    if (__builtin_cpu_supports("avx2")) {
+      return MinPlusRowAvx2;
+    }
+    if (__builtin_cpu_supports("sse2")) {
+      return MinPlusRowSse2;
+    }
+#endif
+    return MinPlusRowScalar;
+  }
+
+  // Chosen once per process from the features of the running CPU.
+  inline const MinPlusRowKernel MIN_PLUS_ROW = SelectMinPlusRowKernel();
+
+}
@@ -1,138 +1,328 @@
 #pragma once
 
 #include "graph.h"
+#include "min_plus.h"
+#include "thread_pool.h"
 
 #include <algorithm>
 #include <cassert>
 #include <cstdint>
 #include <iterator>
+#include <limits>
 #include <optional>
-#include <unordered_map>
+#include <type_traits>
 #include <utility>
 #include <vector>
 
 namespace Graph {
 
   template <typename Weight>
-  class Router {
+  class RouterBase {
+  public:
+    struct RouteInfo {
+      Weight weight;
+      size_t edge_count;
+    };
+
+    virtual ~RouterBase() = default;
+
+    // Replaces the contents of edges with the route edges from first to last.
+    // The buffer keeps its capacity, so a caller reusing it between queries
+    // stops allocating once it has grown to the longest route. Safe to call
+    // from several threads with different buffers.
+    virtual std::optional<RouteInfo> BuildRoute(VertexId from, VertexId to, std::vector<EdgeId>& edges) const = 0;
+
+    // Calls visit_edge(edge_id) for every route edge from first to last and
+    // returns the route weight. The edges go through a per-thread buffer, so
+    // visit_edge must not build routes itself.
+    template <typename EdgeVisitor>
+    std::optional<Weight> VisitRoute(VertexId from, VertexId to, EdgeVisitor visit_edge) const {
+      thread_local std::vector<EdgeId> edges;
+      const auto route_info = BuildRoute(from, to, edges);
+      if (!route_info) {
+        return std::nullopt;
+      }
+      for (const EdgeId edge_id : edges) {
+        visit_edge(edge_id);
+      }
+      return route_info->weight;
+    }
+
+    // Bytes held by precomputed routes, 0 for a router that searches per query.
+    virtual size_t GetTableBytes() const {
+      return 0;
+    }
+  };
+
+
+  template <typename Weight>
+  class Router : public RouterBase<Weight> {
   private:
     using Graph = DirectedWeightedGraph<Weight>;
 
   public:
-    Router(const Graph& graph);
+    // The graph must be frozen. thread_count threads share the table
+    // construction, 0 means one per core.
+    Router(const Graph& graph, size_t thread_count = 1);
 
-    using RouteId = uint64_t;
+    using typename RouterBase<Weight>::RouteInfo;
 
-    struct RouteInfo {
-      RouteId id;
-      Weight weight;
-      size_t edge_count;
-    };
+    std::optional<RouteInfo> BuildRoute(VertexId from, VertexId to, std::vector<EdgeId>& edges) const override;
+
+    // All-pairs table kept as two contiguous row-major vertex_count x vertex_count
+    // arrays: 32-bit weights and 32-bit edge ids. A missing route has an infinite
+    // weight, a trivial (vertex to itself) route has no previous edge.
+    //
+    // The relaxation takes the previous edge from the row of the intermediate
+    // vertex: its only empty entry is the diagonal one, whose candidate is never
+    // strictly better, so the plain min-plus kernel is exact.
+    using StoredWeight = float;
+    using StoredEdgeId = uint32_t;
+    static constexpr StoredWeight NO_ROUTE = std::numeric_limits<StoredWeight>::infinity();
+    static constexpr StoredEdgeId NO_EDGE = std::numeric_limits<StoredEdgeId>::max();
+
+    // Answers queries over a table saved from GetWeights and GetPrevEdges of a
+    // router for the same graph, skipping the O(V^3) construction. The table is
+    // used in place, e.g. straight from a read-only memory-mapped file, and must
+    // outlive the router.
+    Router(const Graph& graph, const StoredWeight* weights, const StoredEdgeId* prev_edges);
 
-    std::optional<RouteInfo> BuildRoute(VertexId from, VertexId to) const;
-    EdgeId GetRouteEdge(RouteId route_id, size_t edge_idx) const;
-    void ReleaseRoute(RouteId route_id);
+    // Checks that every route in the table can be walked: its previous edges
+    // exist, lead into the vertex they are stored for and form a chain back to
+    // the route source. BuildRoute relies on this, so a table that did not come
+    // from this class should be checked once before it is queried. O(V^2).
+    bool HasValidRoutes() const;
+
+    // vertex_count x vertex_count row-major arrays.
+    const StoredWeight* GetWeights() const {
+      return weights_;
+    }
+
+    const StoredEdgeId* GetPrevEdges() const {
+      return prev_edges_;
+    }
+
+    size_t GetTableBytes() const override {
+      return vertex_count_ * vertex_count_ * (sizeof(StoredWeight) + sizeof(StoredEdgeId));
+    }
 
   private:
     const Graph& graph_;
 
-    struct RouteInternalData {
-      Weight weight;
-      std::optional<EdgeId> prev_edge;
+    struct RoutesInternalData {
+      std::vector<StoredWeight> weights;
+      std::vector<StoredEdgeId> prev_edges;
     };
-    using RoutesInternalData = std::vector<std::vector<std::optional<RouteInternalData>>>;
 
-    using ExpandedRoute = std::vector<EdgeId>;
-    mutable RouteId next_route_id_ = 0;
-    mutable std::unordered_map<RouteId, ExpandedRoute> expanded_routes_cache_;
+    size_t GetTableIndex(VertexId vertex_from, VertexId vertex_to) const {
+      return vertex_from * vertex_count_ + vertex_to;
+    }
 
     void InitializeRoutesInternalData(const Graph& graph) {
-      const size_t vertex_count = graph.GetVertexCount();
-      for (VertexId vertex = 0; vertex < vertex_count; ++vertex) {
-        routes_internal_data_[vertex][vertex] = RouteInternalData{0, std::nullopt};
-        for (const EdgeId edge_id : graph.GetIncidentEdges(vertex)) {
-          const auto& edge = graph.GetEdge(edge_id);
-          assert(edge.weight >= 0);
-          auto& route_internal_data = routes_internal_data_[vertex][edge.to];
-          if (!route_internal_data || route_internal_data->weight > edge.weight) {
-            route_internal_data = RouteInternalData{edge.weight, edge_id};
+      for (VertexId vertex = 0; vertex < vertex_count_; ++vertex) {
+        routes_internal_data_.weights[GetTableIndex(vertex, vertex)] = 0;
+        const EdgeId edges_end = graph.GetOutEdgesEnd(vertex);
+        for (EdgeId edge_id = graph.GetOutEdgesBegin(vertex); edge_id < edges_end; ++edge_id) {
+          assert(graph.GetEdgeWeight(edge_id) >= 0);
+          const size_t index = GetTableIndex(vertex, graph.GetEdgeTarget(edge_id));
+          const StoredWeight edge_weight = static_cast<StoredWeight>(graph.GetEdgeWeight(edge_id));
+          if (routes_internal_data_.weights[index] > edge_weight) {
+            routes_internal_data_.weights[index] = edge_weight;
+            routes_internal_data_.prev_edges[index] = static_cast<StoredEdgeId>(edge_id);
           }
         }
       }
     }
 
-    void RelaxRoute(VertexId vertex_from, VertexId vertex_to,
-                    const RouteInternalData& route_from, const RouteInternalData& route_to) {
-      auto& route_relaxing = routes_internal_data_[vertex_from][vertex_to];
-      const Weight candidate_weight = route_from.weight + route_to.weight;
-      if (!route_relaxing || candidate_weight < route_relaxing->weight) {
-        route_relaxing = {
-            candidate_weight,
-            route_to.prev_edge
-                ? route_to.prev_edge
-                : route_from.prev_edge
-        };
+    // Blocked Floyd–Warshall. The table is cut into BLOCK_SIZE x BLOCK_SIZE tiles
+    // and the intermediate vertices are taken one block at a time. For every block
+    // the diagonal tile goes first, then the tiles in its row and column, then all
+    // the remaining tiles; tiles of the last two phases run in parallel.
+    //
+    // To stay bit-identical with the plain k-i-j loop, a tile relaxes through
+    // vertex k with exactly the values the plain loop would use: row k and column
+    // k as they were before step k. Tiles holding row k or column k save those
+    // values into block_rows / block_columns right before step k, and every other
+    // tile reads them from there instead of the (by then further relaxed) table.
+    struct BlockSnapshot {
+      std::vector<StoredWeight> row_weights;    // BLOCK_SIZE x vertex_count
+      std::vector<StoredEdgeId> row_prev_edges; // BLOCK_SIZE x vertex_count
+      std::vector<StoredWeight> column_weights; // vertex_count x BLOCK_SIZE
+    };
+
+    static constexpr size_t BLOCK_SIZE = 64;
+
+    void RelaxTile(size_t row_block, size_t column_block, size_t through_block, BlockSnapshot& snapshot) {
+      const size_t row_begin = row_block * BLOCK_SIZE;
+      const size_t row_end = std::min(row_begin + BLOCK_SIZE, vertex_count_);
+      const size_t column_begin = column_block * BLOCK_SIZE;
+      const size_t column_count = std::min(column_begin + BLOCK_SIZE, vertex_count_) - column_begin;
+      const size_t through_begin = through_block * BLOCK_SIZE;
+      const size_t through_end = std::min(through_begin + BLOCK_SIZE, vertex_count_);
+
+      for (VertexId vertex_through = through_begin; vertex_through < through_end; ++vertex_through) {
+        const size_t through_idx = vertex_through - through_begin;
+        StoredWeight* row_weights = &snapshot.row_weights[through_idx * vertex_count_ + column_begin];
+        StoredEdgeId* row_prev_edges = &snapshot.row_prev_edges[through_idx * vertex_count_ + column_begin];
+        if (row_block == through_block) {
+          std::copy_n(&routes_internal_data_.weights[GetTableIndex(vertex_through, column_begin)],
+                      column_count, row_weights);
+          std::copy_n(&routes_internal_data_.prev_edges[GetTableIndex(vertex_through, column_begin)],
+                      column_count, row_prev_edges);
+        }
+        if (column_block == through_block) {
+          for (VertexId vertex_from = row_begin; vertex_from < row_end; ++vertex_from) {
+            snapshot.column_weights[vertex_from * BLOCK_SIZE + through_idx] =
+                routes_internal_data_.weights[GetTableIndex(vertex_from, vertex_through)];
+          }
+        }
+        for (VertexId vertex_from = row_begin; vertex_from < row_end; ++vertex_from) {
+          const StoredWeight weight_from = snapshot.column_weights[vertex_from * BLOCK_SIZE + through_idx];
+          if (weight_from == NO_ROUTE) {
+            continue;
+          }
+          MIN_PLUS_ROW(weight_from, column_count, row_weights, row_prev_edges,
+                   &routes_internal_data_.weights[GetTableIndex(vertex_from, column_begin)],
+                   &routes_internal_data_.prev_edges[GetTableIndex(vertex_from, column_begin)]);
+        }
       }
     }
 
-    void RelaxRoutesInternalDataThroughVertex(size_t vertex_count, VertexId vertex_through) {
-      for (VertexId vertex_from = 0; vertex_from < vertex_count; ++vertex_from) {
-        if (const auto& route_from = routes_internal_data_[vertex_from][vertex_through]) {
-          for (VertexId vertex_to = 0; vertex_to < vertex_count; ++vertex_to) {
-            if (const auto& route_to = routes_internal_data_[vertex_through][vertex_to]) {
-              RelaxRoute(vertex_from, vertex_to, *route_from, *route_to);
-            }
+    void RelaxRoutesInternalData(ThreadPool& pool) {
+      const size_t block_count = (vertex_count_ + BLOCK_SIZE - 1) / BLOCK_SIZE;
+      BlockSnapshot snapshot{
+          std::vector<StoredWeight>(BLOCK_SIZE * vertex_count_),
+          std::vector<StoredEdgeId>(BLOCK_SIZE * vertex_count_),
+          std::vector<StoredWeight>(vertex_count_ * BLOCK_SIZE)
+      };
+
+      for (size_t through_block = 0; through_block < block_count; ++through_block) {
+        RelaxTile(through_block, through_block, through_block, snapshot);
+
+        // Row tiles first, then column tiles, skipping the diagonal one.
+        pool.ParallelFor(2 * (block_count - 1), [&](size_t task) {
+          size_t block = task % (block_count - 1);
+          block += block >= through_block;
+          if (task < block_count - 1) {
+            RelaxTile(through_block, block, through_block, snapshot);
+          } else {
+            RelaxTile(block, through_block, through_block, snapshot);
           }
-        }
+        });
+
+        pool.ParallelFor((block_count - 1) * (block_count - 1), [&](size_t task) {
+          size_t row_block = task / (block_count - 1);
+          size_t column_block = task % (block_count - 1);
+          row_block += row_block >= through_block;
+          column_block += column_block >= through_block;
+          RelaxTile(row_block, column_block, through_block, snapshot);
+        });
       }
     }
 
+    size_t vertex_count_;
+    // Filled while the table is built, empty for a router over an external table.
     RoutesInternalData routes_internal_data_;
+    // The table queries read: routes_internal_data_ or the external arrays.
+    const StoredWeight* weights_;
+    const StoredEdgeId* prev_edges_;
   };
 
 
   template <typename Weight>
-  Router<Weight>::Router(const Graph& graph)
+  Router<Weight>::Router(const Graph& graph, size_t thread_count)
       : graph_(graph),
-        routes_internal_data_(graph.GetVertexCount(), std::vector<std::optional<RouteInternalData>>(graph.GetVertexCount()))
+        vertex_count_(graph.GetVertexCount()),
+        routes_internal_data_{
+            std::vector<StoredWeight>(vertex_count_ * vertex_count_, NO_ROUTE),
+            std::vector<StoredEdgeId>(vertex_count_ * vertex_count_, NO_EDGE)
+        }
   {
+    static_assert(std::is_floating_point_v<Weight>, "Router table stores weights as float");
+    assert(graph.IsFrozen());
+    assert(graph.GetEdgeCount() < NO_EDGE);
+
     InitializeRoutesInternalData(graph);
 
-    const size_t vertex_count = graph.GetVertexCount();
-    for (VertexId vertex_through = 0; vertex_through < vertex_count; ++vertex_through) {
-      RelaxRoutesInternalDataThroughVertex(vertex_count, vertex_through);
+    ThreadPool pool(thread_count);
+    RelaxRoutesInternalData(pool);
+    weights_ = routes_internal_data_.weights.data();
+    prev_edges_ = routes_internal_data_.prev_edges.data();
+  }
+
+  template <typename Weight>
+  Router<Weight>::Router(const Graph& graph, const StoredWeight* weights, const StoredEdgeId* prev_edges)
+      : graph_(graph),
+        vertex_count_(graph.GetVertexCount()),
+        weights_(weights),
+        prev_edges_(prev_edges)
+  {
+  }
+
+  template <typename Weight>
+  bool Router<Weight>::HasValidRoutes() const {
+    enum class State : uint8_t { UNKNOWN, VISITING, VALID };
+    std::vector<State> states(vertex_count_);
+    std::vector<VertexId> chain;
+    for (VertexId from = 0; from < vertex_count_; ++from) {
+      std::fill(std::begin(states), std::end(states), State::UNKNOWN);
+      for (VertexId to = 0; to < vertex_count_; ++to) {
+        if (weights_[GetTableIndex(from, to)] == NO_ROUTE) {
+          continue;
+        }
+        // Walks back from to until a vertex already known to be valid or the
+        // source; reaching a vertex of the current walk again means a cycle.
+        chain.clear();
+        VertexId vertex = to;
+        while (states[vertex] == State::UNKNOWN) {
+          states[vertex] = State::VISITING;
+          chain.push_back(vertex);
+          const StoredEdgeId edge_id = prev_edges_[GetTableIndex(from, vertex)];
+          if (edge_id == NO_EDGE) {
+            if (vertex != from) {
+              return false;
+            }
+            states[vertex] = State::VALID;
+            break;
+          }
+          if (edge_id >= graph_.GetEdgeCount() || graph_.GetEdge(edge_id).to != vertex) {
+            return false;
+          }
+          vertex = graph_.GetEdge(edge_id).from;
+        }
+        if (states[vertex] != State::VALID) {
+          return false;
+        }
+        for (const VertexId visited : chain) {
+          states[visited] = State::VALID;
+        }
+      }
     }
+    return true;
   }
 
+  // The table only keeps single precision weights, so the returned weight is
+  // summed from the graph edges along the route.
   template <typename Weight>
-  std::optional<typename Router<Weight>::RouteInfo> Router<Weight>::BuildRoute(VertexId from, VertexId to) const {
-    const auto& route_internal_data = routes_internal_data_[from][to];
-    if (!route_internal_data) {
+  std::optional<typename Router<Weight>::RouteInfo>
+  Router<Weight>::BuildRoute(VertexId from, VertexId to, std::vector<EdgeId>& edges) const {
+    edges.clear();
+    if (weights_[GetTableIndex(from, to)] == NO_ROUTE) {
       return std::nullopt;
     }
-    const Weight weight = route_internal_data->weight;
-    std::vector<EdgeId> edges;
-    for (std::optional<EdgeId> edge_id = route_internal_data->prev_edge;
-         edge_id;
-         edge_id = routes_internal_data_[from][graph_.GetEdge(*edge_id).from]->prev_edge) {
-      edges.push_back(*edge_id);
+    for (StoredEdgeId edge_id = prev_edges_[GetTableIndex(from, to)];
+         edge_id != NO_EDGE;
+         edge_id = prev_edges_[GetTableIndex(from, graph_.GetEdge(edge_id).from)]) {
+      edges.push_back(edge_id);
     }
     std::reverse(std::begin(edges), std::end(edges));
 
-    const RouteId route_id = next_route_id_++;
-    const size_t route_edge_count = edges.size();
-    expanded_routes_cache_[route_id] = std::move(edges);
-    return RouteInfo{route_id, weight, route_edge_count};
-  }
-
-  template <typename Weight>
-  EdgeId Router<Weight>::GetRouteEdge(RouteId route_id, size_t edge_idx) const {
-    return expanded_routes_cache_.at(route_id)[edge_idx];
-  }
+    Weight weight = 0;
+    for (const EdgeId edge_id : edges) {
+      weight += graph_.GetEdge(edge_id).weight;
+    }
 
-  template <typename Weight>
-  void Router<Weight>::ReleaseRoute(RouteId route_id) {
-    expanded_routes_cache_.erase(route_id);
+    return RouteInfo{weight, edges.size()};
   }
 
 }
@@ -0,0 +1,124 @@
+#pragma once
+
+#include <cstdint>
+#include <iostream>
+#include <stdexcept>
+#include <string>
+#include <string_view>
+#include <type_traits>
+#include <vector>
+
+// Raw binary encoding used by snapshots. Values are written in the native byte
+// order and layout, so a snapshot is only meant to be read on the machine type
+// that wrote it.
+//
+// Large arrays are written at ARRAY_ALIGNMENT-aligned offsets from the start of
+// the snapshot, so a reader over a mapped or in-memory copy can use them in place.
+namespace Serialization {
+
+  constexpr size_t ARRAY_ALIGNMENT = 64;
+
+  template <typename T>
+  void WriteValue(std::ostream& output, const T& value) {
+    static_assert(std::is_trivially_copyable_v<T>);
+    output.write(reinterpret_cast<const char*>(&value), sizeof(T));
+  }
+
+  inline void WriteString(std::ostream& output, std::string_view str) {
+    WriteValue<uint32_t>(output, str.size());
+    output.write(str.data(), str.size());
+  }
+
+  // Writes the element count, pads the output up to the next aligned offset
+  // from snapshot_begin and writes the elements.
+  template <typename T>
+  void WriteArray(std::ostream& output, std::streampos snapshot_begin, const T* values, size_t count) {
+    static_assert(std::is_trivially_copyable_v<T> && alignof(T) <= ARRAY_ALIGNMENT);
+    WriteValue<uint64_t>(output, count);
+    const size_t offset = output.tellp() - snapshot_begin;
+    const size_t padding = (ARRAY_ALIGNMENT - offset % ARRAY_ALIGNMENT) % ARRAY_ALIGNMENT;
+    output.write(std::string(padding, '\0').data(), padding);
+    output.write(reinterpret_cast<const char*>(values), count * sizeof(T));
+  }
+
+  // Reads a snapshot held in memory. Arrays are returned as pointers into the
+  // data, which must start at an ARRAY_ALIGNMENT-aligned address.
+  class Reader {
+  public:
+    explicit Reader(std::string_view data) : data_(data) {}
+
+    template <typename T>
+    T ReadValue() {
+      static_assert(std::is_trivially_copyable_v<T>);
+      T value;
+      std::char_traits<char>::copy(reinterpret_cast<char*>(&value), Take(sizeof(T)), sizeof(T));
+      return value;
+    }
+
+    // Reads a Count-typed element count and checks that the rest of the data
+    // can hold that many elements of at least min_size bytes, so a damaged
+    // count cannot make the caller reserve more memory than the snapshot has.
+    template <typename Count>
+    size_t ReadCount(size_t min_size) {
+      const size_t count = ReadValue<Count>();
+      if (count > (data_.size() - pos_) / min_size) {
+        throw std::runtime_error("snapshot is truncated");
+      }
+      return count;
+    }
+
+    std::string_view ReadString() {
+      const size_t size = ReadValue<uint32_t>();
+      return {Take(size), size};
+    }
+
+    template <typename T>
+    std::pair<const T*, size_t> ReadArray() {
+      static_assert(std::is_trivially_copyable_v<T> && alignof(T) <= ARRAY_ALIGNMENT);
+      const size_t count = ReadValue<uint64_t>();
+      Take((ARRAY_ALIGNMENT - pos_ % ARRAY_ALIGNMENT) % ARRAY_ALIGNMENT);
+      if (count > (data_.size() - pos_) / sizeof(T)) {
+        throw std::runtime_error("snapshot is truncated");
+      }
+      return {reinterpret_cast<const T*>(Take(count * sizeof(T))), count};
+    }
+
+  private:
+    const char* Take(size_t size) {
+      if (size > data_.size() - pos_) {
+        throw std::runtime_error("snapshot is truncated");
+      }
+      const char* result = data_.data() + pos_;
+      pos_ += size;
+      return result;
+    }
+
+    std::string_view data_;
+    size_t pos_ = 0;
+  };
+
+  // Read-only bytes of a snapshot. A regular file is mapped into memory, so
+  // processes loading the same file share its pages through the page cache;
+  // anything else is read into an aligned buffer.
+  class SnapshotData {
+  public:
+    static SnapshotData FromFile(const std::string& path);
+    static SnapshotData FromStream(std::istream& input);
+
+    SnapshotData() = default;
+    SnapshotData(SnapshotData&& other);
+    SnapshotData& operator=(SnapshotData&& other);
+    ~SnapshotData();
+
+    std::string_view GetData() const;
+
+  private:
+    void Release();
+
+    void* mapped_data_ = nullptr;
+    size_t mapped_size_ = 0;
+    std::vector<std::aligned_storage_t<ARRAY_ALIGNMENT, ARRAY_ALIGNMENT>> content_;
+    size_t content_size_ = 0;
+  };
+
+}
@@ -0,0 +1,47 @@
+#pragma once
+
+#include <cstring>
+#include <memory>
+#include <string_view>
+#include <vector>
+
+// Append-only arena of string copies. Strings are packed into large blocks that
+// are never moved or freed before the pool itself, so every string_view handed
+// out by Store stays valid for the lifetime of the pool.
+class StringPool {
+public:
+  static constexpr size_t BLOCK_SIZE = 1 << 16;
+
+  std::string_view Store(std::string_view str) {
+    if (str.empty()) {
+      return {};
+    }
+    if (str.size() > BLOCK_SIZE / 4) {
+      // Long strings get a block of their own so the current block is not wasted.
+      large_blocks_.push_back(std::make_unique<char[]>(str.size()));
+      std::memcpy(large_blocks_.back().get(), str.data(), str.size());
+      total_size_ += str.size();
+      return {large_blocks_.back().get(), str.size()};
+    }
+    if (block_used_ + str.size() > BLOCK_SIZE) {
+      blocks_.push_back(std::make_unique<char[]>(BLOCK_SIZE));
+      block_used_ = 0;
+    }
+    char* data = blocks_.back().get() + block_used_;
+    std::memcpy(data, str.data(), str.size());
+    block_used_ += str.size();
+    total_size_ += str.size();
+    return {data, str.size()};
+  }
+
+  // Bytes of string data stored so far.
+  size_t Size() const {
+    return total_size_;
+  }
+
+private:
+  std::vector<std::unique_ptr<char[]>> blocks_;
+  std::vector<std::unique_ptr<char[]>> large_blocks_;
+  size_t block_used_ = BLOCK_SIZE;
+  size_t total_size_ = 0;
+};
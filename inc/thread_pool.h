@@ -0,0 +1,44 @@
+#pragma once
+
+#include <atomic>
+#include <condition_variable>
+#include <cstddef>
+#include <functional>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+// Fixed set of worker threads running data-parallel loops. The calling thread
+// takes part in every loop, so a pool of N threads starts N - 1 workers.
+class ThreadPool {
+public:
+  // thread_count == 0 means one thread per hardware core.
+  explicit ThreadPool(size_t thread_count);
+  ~ThreadPool();
+
+  ThreadPool(const ThreadPool&) = delete;
+  ThreadPool& operator=(const ThreadPool&) = delete;
+
+  size_t GetThreadCount() const;
+
+  // Calls task(index) for every index in [0, task_count) and returns when all
+  // of them have finished. Indices are handed out one by one to whichever
+  // thread is free, so tasks of uneven cost balance themselves.
+  void ParallelFor(size_t task_count, const std::function<void(size_t)>& task);
+
+private:
+  void WorkerLoop();
+  void RunTasks();
+
+  std::vector<std::thread> workers_;
+  std::mutex mutex_;
+  std::condition_variable work_ready_;
+  std::condition_variable work_done_;
+
+  const std::function<void(size_t)>* current_task_ = nullptr;
+  size_t current_task_count_ = 0;
+  std::atomic<size_t> next_task_index_ = 0;
+  size_t generation_ = 0;
+  size_t busy_workers_ = 0;
+  bool stopping_ = false;
+};
@@ -0,0 +1,108 @@
+#pragma once
+
+#include <chrono>
+#include <cstdint>
+#include <mutex>
+#include <ostream>
+#include <string>
+#include <string_view>
+#include <utility>
+#include <variant>
+#include <vector>
+
+// Timeline of the run in the Chrome trace event format. The saved file opens
+// in chrome://tracing or ui.perfetto.dev, both of which load it locally. Every
+// span is a complete ("X") event on the thread that ran it, so nested spans of
+// one thread stack up and the spans of pool threads line up side by side.
+namespace Trace {
+
+  using Clock = std::chrono::steady_clock;
+  using ArgValue = std::variant<int, std::string>;
+
+  struct Event {
+    std::string name;
+    const char* category;
+    Clock::time_point start;
+    Clock::duration duration;
+    uint32_t thread_id;
+    std::vector<std::pair<const char*, ArgValue>> args;
+  };
+
+  class Recorder {
+  public:
+    // An empty path keeps the recorder disabled.
+    explicit Recorder(std::string path = {})
+        : path_(std::move(path)), start_(Clock::now()) {}
+
+    // Process-wide recorder, enabled when the TRANSPORT_TRACE environment
+    // variable names the trace file.
+    static Recorder& Global();
+
+    bool IsEnabled() const {
+      return !path_.empty();
+    }
+
+    void AddEvent(Event event);
+    // Drops the events recorded so far.
+    void Clear();
+
+    void WriteTrace(std::ostream& output) const;
+    // Writes the trace to its file. Does nothing if the recorder is disabled.
+    void Save() const;
+
+    // Small dense id of the calling thread, stable for its lifetime.
+    static uint32_t GetThreadId();
+
+  private:
+    const std::string path_;
+    const Clock::time_point start_;
+    mutable std::mutex mutex_;
+    std::vector<Event> events_;
+  };
+
+  // Records its lifetime as one event. When the recorder is disabled nothing is
+  // copied: the name and the arguments are dropped right away.
+  class Span {
+  public:
+    Span(Recorder& recorder, std::string_view name, const char* category)
+        : recorder_(recorder.IsEnabled() ? &recorder : nullptr) {
+      if (recorder_) {
+        event_.name = name;
+        event_.category = category;
+        event_.start = Clock::now();
+      }
+    }
+
+    Span(std::string_view name, const char* category) : Span(Recorder::Global(), name, category) {}
+
+    ~Span() {
+      if (recorder_) {
+        event_.duration = Clock::now() - event_.start;
+        event_.thread_id = Recorder::GetThreadId();
+        recorder_->AddEvent(std::move(event_));
+      }
+    }
+
+    Span(const Span&) = delete;
+    Span& operator=(const Span&) = delete;
+
+    Span& Arg(const char* key, int value) {
+      if (recorder_) {
+        event_.args.emplace_back(key, value);
+      }
+      return *this;
+    }
+
+    Span& Arg(const char* key, std::string_view value) {
+      if (recorder_) {
+        event_.args.emplace_back(key, std::string(value));
+      }
+      return *this;
+    }
+
+  private:
+    Recorder* recorder_;
+    Event event_;
+  };
+
+}
@@ -1,108 +1,309 @@
 #include "Requests.h"
+#include <algorithm>
 #include <set>
+#include <cmath>
 
 using namespace std;
 
-//------------------Request---------------------------//
+namespace {
+
+double ToRadians(double degrees) {
+  return 3.1415926535 * degrees / 180;
+}
 
-Request::Request(Type type) : type(type) {}
+// Fields of a base request, one bit each, to tell which ones have been read.
+enum BaseRequestField : unsigned {
+  TYPE_FIELD = 1 << 0,
+  NAME_FIELD = 1 << 1,
+  LATITUDE_FIELD = 1 << 2,
+  LONGITUDE_FIELD = 1 << 3,
+  ROAD_DISTANCES_FIELD = 1 << 4,
+  STOPS_FIELD = 1 << 5,
+  IS_ROUNDTRIP_FIELD = 1 << 6,
+};
+
+const unordered_map<string_view, BaseRequestField> BASE_REQUEST_FIELDS = {
+	{"type", TYPE_FIELD},
+	{"name", NAME_FIELD},
+	{"latitude", LATITUDE_FIELD},
+	{"longitude", LONGITUDE_FIELD},
+	{"road_distances", ROAD_DISTANCES_FIELD},
+	{"stops", STOPS_FIELD},
+	{"is_roundtrip", IS_ROUNDTRIP_FIELD},
+};
 
-RequestHolder Request::Create(Request::Type type) {
-  switch (type) {
-    case Request::Type::MODIFY_BUS:
-      return std::make_unique<ModifyBusRequest>();
-    case Request::Type::MODIFY_STOP:
-      return std::make_unique<ModifyStopRequest>();
-    case Request::Type::READ_BUS:
-	  return std::make_unique<ReadBusRequest>();
-    case Request::Type::READ_STOP:
-    	  return std::make_unique<ReadStopRequest>();
-    case Request::Type::READ_ROUTE:
-		  return std::make_unique<ReadRouteRequest>();
-    default:
-      return nullptr;
-  }
 }
 
-ReadStopRequest::ReadStopRequest() : Request(Type::READ_STOP){}
+//------------------Request---------------------------//
 
-void ReadStopRequest::ParseFrom(const Json::Node& node) {
+void ReadStopRequest::ParseFrom(const Json::CompactNode& node) {
   stop_name = node.AsMap().at("name").AsString();
   id = node.AsMap().at("id").AsInt();
 }
 
-ReadBusRequest::ReadBusRequest() : Request(Type::READ_BUS) {}
-
-void ReadBusRequest::ParseFrom(const Json::Node& node) {
+void ReadBusRequest::ParseFrom(const Json::CompactNode& node) {
   bus_name = node.AsMap().at("name").AsString();
   id = node.AsMap().at("id").AsInt();
 }
 
-ReadRouteRequest::ReadRouteRequest() :Request(Type::READ_ROUTE){}
-void ReadRouteRequest::ParseFrom(const Json::Node& node) {
+void ReadRouteRequest::ParseFrom(const Json::CompactNode& node) {
   id = node.AsMap().at("id").AsInt();
   from = node.AsMap().at("from").AsString();
   to = node.AsMap().at("to").AsString();
 }
 
-ModifyBusRequest::ModifyBusRequest() : Request(Type::MODIFY_BUS) {}
-
-void ModifyBusRequest::ParseFrom(const Json::Node& node) {
+void ModifyBusRequest::ParseFrom(const Json::CompactNode& node) {
   bus_name = node.AsMap().at("name").AsString();
   cycle = node.AsMap().at("is_roundtrip").AsBool();
-  for(const Json::Node& node: node.AsMap().at("stops").AsArray()) {
-	stops.push_back(node.AsString());
+  for(const Json::CompactNode& node: node.AsMap().at("stops").AsArray()) {
+	stops.emplace_back(node.AsString());
   }
 }
 
-ModifyStopRequest::ModifyStopRequest() : Request(Type::MODIFY_STOP) {}
-
-void ModifyStopRequest::ParseFrom(const Json::Node& node) {
+void ModifyStopRequest::ParseFrom(const Json::CompactNode& node) {
   for(auto [key, value] :node.AsMap().at("road_distances").AsMap()) {
-    distances.push_back({value.AsInt(), std::move(key)});
+    distances.push_back({value.AsInt(), std::string(key)});
   }
-  longitude = 3.1415926535 * node.AsMap().at("longitude").AsDouble() / 180;
+  longitude = ToRadians(node.AsMap().at("longitude").AsDouble());
   stop_name = node.AsMap().at("name").AsString();
-  latitude = 3.1415926535 * node.AsMap().at("latitude").AsDouble() / 180;
+  latitude = ToRadians(node.AsMap().at("latitude").AsDouble());
 }
 
-optional<Json::Node> ReadStopRequest::Accept(const Visitor& v) const {
-  return v.Visit(*this);
+//------------------Request---------------------------//
 
-}
-optional<Json::Node> ReadBusRequest::Accept(const Visitor& v) const {
+//------------------Parsing Functions-----------------//
+
+optional<RequestType> ConvertRequestTypeFromString(string_view type_str,
+		const unordered_map<string_view, RequestType>& str_to_type) {
+
+  if (const auto it = str_to_type.find(type_str);
+	it != str_to_type.end()) {
+	return it->second;
+  } else {
+	return nullopt;
+  }
 
-  return v.Visit(*this);
 }
 
-optional<Json::Node> ReadRouteRequest::Accept(const Visitor& v) const {
-  return v.Visit(*this);
+size_t JsonParser::GetSizeSetting(const Json::CompactNode& node, string_view name) {
+  const double value = node.IsInt() || node.IsDouble() ? node.AsDouble() : -1;
+  // 2^64 is the first double that does not fit size_t.
+  if(!(value >= 0 && value < 18446744073709551616.0) || value != floor(value)) {
+	throw invalid_argument(string(name) + " must be a non-negative integer");
+  }
+  return static_cast<size_t>(value);
+}
 
+BaseRequests JsonParser::ParseBaseRequests(const Json::CompactNode& node) {
+  BaseRequests requests;
+  for(const Json::CompactNode& request: node.AsArray()) {
+	const auto type = ConvertRequestTypeFromString(request.AsMap().at("type").AsString(),
+		MODIFY_REQUEST_TYPE);
+	if(type == RequestType::MODIFY_STOP) {
+	  requests.stops.emplace_back().ParseFrom(request);
+	} else if(type == RequestType::MODIFY_BUS) {
+	  requests.buses.emplace_back().ParseFrom(request);
+	}
+  }
+  return requests;
 }
-optional<Json::Node> ModifyBusRequest::Accept(const Visitor& v) const {
-  v.Visit(*this);
-  return nullopt;
+
+vector<StatRequest> JsonParser::ParseStatRequests(const Json::CompactDocument& doc) {
+  vector<StatRequest> requests;
+  for(const Json::CompactNode& node: doc.GetRoot().AsMap().at("stat_requests").AsArray()) {
+	if(optional<StatRequest> request = ParseStatRequest(node)) {
+	  requests.push_back(move(*request));
+	}
+  }
+  return requests;
 }
 
-optional<Json::Node> ModifyStopRequest::Accept(const Visitor& v) const {
-  v.Visit(*this);
-  return nullopt;
+optional<StatRequest> JsonParser::ParseStatRequest(const Json::CompactNode& node) {
+  const auto type = ConvertRequestTypeFromString(node.AsMap().at("type").AsString(),
+	  READ_REQUEST_TYPE);
+  if(!type) {
+	return nullopt;
+  }
+  StatRequest request;
+  switch(*type) {
+	case RequestType::READ_STOP:
+	  request.emplace<ReadStopRequest>();
+	  break;
+	case RequestType::READ_BUS:
+	  request.emplace<ReadBusRequest>();
+	  break;
+	case RequestType::READ_ROUTE:
+	  request.emplace<ReadRouteRequest>();
+	  break;
+	default:
+	  return nullopt;
+  }
+  visit([&node](auto& typed_request) { typed_request.ParseFrom(node); }, request);
+  return request;
 }
 
-//------------------Request---------------------------//
+BaseRequests JsonParser::ReadBaseRequests(string_view base_requests) {
+  BaseRequests requests;
+  if(base_requests.empty()) {
+	return requests;
+  }
+  Json::Parser parser(base_requests);
+  string scratch;
+  parser.Expect('[');
+  if(parser.TryConsume(']')) {
+	return requests;
+  }
+  do {
+	// The type may come after the other fields, so all of them are read before
+	// the request is picked. Like in the DOM, the first of duplicate keys wins.
+	optional<RequestType> type;
+	string name;
+	ModifyStopRequest stop;
+	ModifyBusRequest bus;
+	unsigned fields = 0;
+	parser.Expect('{');
+	if(!parser.TryConsume('}')) {
+	  do {
+		const auto field_it = BASE_REQUEST_FIELDS.find(parser.ParseString(scratch));
+		parser.Expect(':');
+		if(field_it == BASE_REQUEST_FIELDS.end() || (fields & field_it->second)) {
+		  parser.SkipValue();
+		  continue;
+		}
+		fields |= field_it->second;
+		switch(field_it->second) {
+		case TYPE_FIELD:
+		  type = ConvertRequestTypeFromString(parser.ParseString(scratch), MODIFY_REQUEST_TYPE);
+		  break;
+		case NAME_FIELD:
+		  name = parser.ParseString(scratch);
+		  break;
+		case LATITUDE_FIELD:
+		  stop.latitude = ToRadians(parser.ParseNumber().AsDouble());
+		  break;
+		case LONGITUDE_FIELD:
+		  stop.longitude = ToRadians(parser.ParseNumber().AsDouble());
+		  break;
+		case ROAD_DISTANCES_FIELD:
+		  parser.Expect('{');
+		  if(!parser.TryConsume('}')) {
+			do {
+			  string stop_name(parser.ParseString(scratch));
+			  parser.Expect(':');
+			  stop.distances.push_back({parser.ParseNumber().AsInt(), move(stop_name)});
+			} while(parser.TryConsume(','));
+			parser.Expect('}');
+		  }
+		  break;
+		case STOPS_FIELD:
+		  parser.Expect('[');
+		  if(!parser.TryConsume(']')) {
+			do {
+			  bus.stops.emplace_back(parser.ParseString(scratch));
+			} while(parser.TryConsume(','));
+			parser.Expect(']');
+		  }
+		  break;
+		case IS_ROUNDTRIP_FIELD:
+		  bus.cycle = parser.ParseBool().AsBool();
+		  break;
+		}
+	  } while(parser.TryConsume(','));
+	  parser.Expect('}');
+	}
 
-//------------------Parsing Functions-----------------//
+	auto require = [fields](unsigned required) {
+	  if((fields & required) != required) {
+		throw out_of_range("base request without a required field");
+	  }
+	};
+	require(TYPE_FIELD);
+	if(type == RequestType::MODIFY_STOP) {
+	  require(NAME_FIELD | LATITUDE_FIELD | LONGITUDE_FIELD | ROAD_DISTANCES_FIELD);
+	  // Distances go in key order without duplicates, as the DOM would list them.
+	  auto name_less = [](const DistanceToStop& lhs, const DistanceToStop& rhs) {
+		return lhs.stop_name < rhs.stop_name;
+	  };
+	  auto name_equal = [](const DistanceToStop& lhs, const DistanceToStop& rhs) {
+		return lhs.stop_name == rhs.stop_name;
+	  };
+	  if(!is_sorted(stop.distances.begin(), stop.distances.end(), name_less)) {
+		stable_sort(stop.distances.begin(), stop.distances.end(), name_less);
+	  }
+	  stop.distances.erase(unique(stop.distances.begin(), stop.distances.end(), name_equal),
+		  stop.distances.end());
+	  stop.stop_name = move(name);
+	  requests.stops.push_back(move(stop));
+	} else if(type == RequestType::MODIFY_BUS) {
+	  require(NAME_FIELD | STOPS_FIELD | IS_ROUNDTRIP_FIELD);
+	  bus.bus_name = move(name);
+	  requests.buses.push_back(move(bus));
+	}
+  } while(parser.TryConsume(','));
+  parser.Expect(']');
+  return requests;
+}
 
-optional<Request::Type> ConvertRequestTypeFromString(string_view type_str,
-		const unordered_map<string_view, Request::Type>& str_to_type) {
+JsonParser::InputSections JsonParser::SplitInput(string_view text) {
+  Json::Parser parser(text);
+  InputSections sections;
+  string scratch;
+  // Finds the extent of the next value in the text without parsing it.
+  auto locate_value = [&parser, text] {
+	parser.SkipSpaces();
+	const size_t begin = parser.GetPosition();
+	parser.SkipValue();
+	return text.substr(begin, parser.GetPosition() - begin);
+  };
+  parser.Expect('{');
+  if(parser.TryConsume('}')) {
+	return sections;
+  }
+  do {
+	const string key(parser.ParseString(scratch));
+	parser.Expect(':');
+	if(key == "routing_settings") {
+	  sections.routing_settings = parser.ParseCompactDocument();
+	} else if(key == "serialization_settings") {
+	  sections.serialization_settings = parser.ParseCompactDocument();
+	} else if(key == "base_requests") {
+	  sections.base_requests = locate_value();
+	} else if(key == "stat_requests") {
+	  sections.stat_requests = locate_value();
+	} else {
+	  parser.SkipValue();
+	}
+  } while(parser.TryConsume(','));
+  parser.Expect('}');
+  return sections;
+}
 
-  if (const auto it = str_to_type.find(type_str);
-	it != str_to_type.end()) {
-	return it->second;
-  } else {
-	return nullopt;
+StatRequestStream::StatRequestStream(string_view stat_requests)
+	: parser(stat_requests), at_end(stat_requests.empty()) {
+  if(!at_end) {
+	parser.Expect('[');
+	at_end = parser.TryConsume(']');
   }
+}
 
+bool StatRequestStream::AtEnd() const {
+  return at_end;
+}
+
+vector<StatRequest> StatRequestStream::ReadBatch(size_t max_count) {
+  vector<StatRequest> requests;
+  requests.reserve(max_count);
+  arena.Reset();
+  for(size_t count = 0; count < max_count && !at_end; ++count) {
+	if(optional<StatRequest> request = JsonParser::ParseStatRequest(parser.ParseCompactNode(arena))) {
+	  requests.push_back(move(*request));
+	}
+	if(!parser.TryConsume(',')) {
+	  parser.Expect(']');
+	  at_end = true;
+	}
+  }
+  return requests;
 }
 //------------------Parsing Functions-----------------------------//
 
@@ -139,7 +340,7 @@ Json::Node PrintStopResponse(optional<set<string_view>> stats, int id) {
   return Json::Node(result);
 }
 
-Json::Node PrintRouteResponse(optional<RouteStats<double>> stats, int id) {
+Json::Node PrintRouteResponse(shared_ptr<const RouteStats<double>> stats, int id) {
   using Json::Node;
   map<std::string, Json::Node> result;
   result["request_id"] = Node(id);
@@ -149,7 +350,7 @@ Json::Node PrintRouteResponse(optional<RouteStats<double>> stats, int id) {
 	result["total_time"] = Node(stats->weight);
 	vector<Json::Node> nodes;
 	nodes.reserve(stats->elements_of_route.size() * 2);
-	for(ElementOfRoute& element: stats->elements_of_route) {
+	for(const ElementOfRoute& element: stats->elements_of_route) {
 	  map<std::string, Json::Node> wait;
 	  wait["type"] = Node("Wait"s);
 	  wait["stop_name"] = Node(string(element.start_stop_name));
@@ -173,20 +374,39 @@ Json::Node PrintRouteResponse(optional<RouteStats<double>> stats, int id) {
 //---------------Visitor------------------------------//
 
 Json::Node Visitor::Visit(const ReadBusRequest& request) const {
+  Metrics::LatencyTimer timer(bus_latency);
+  Trace::Span span("ReadBusRequest", "stat_request");
+  span.Arg("id", request.id).Arg("name", request.bus_name);
   auto result = PrintBusResponse(rm->GetBusStats(request.bus_name), request.id);
   return result;
 }
 
 Json::Node Visitor::Visit(const ReadStopRequest& request) const {
+  Metrics::LatencyTimer timer(stop_latency);
+  Trace::Span span("ReadStopRequest", "stat_request");
+  span.Arg("id", request.id).Arg("name", request.stop_name);
   auto result = PrintStopResponse(rm->GetStopStats(request.stop_name), request.id);
   return result;
 }
 
 Json::Node Visitor::Visit(const ReadRouteRequest& request) const {
-  return PrintRouteResponse(rm->GetRouteStats(request.from, request.to), request.id);
+  Metrics::LatencyTimer timer(route_latency);
+  Trace::Span span("ReadRouteRequest", "stat_request");
+  span.Arg("id", request.id).Arg("from", request.from).Arg("to", request.to);
+  auto route_stats = rm->GetRouteStats(request.from, request.to);
+  Metrics::LatencyTimer print_timer(route_print_latency);
+  Trace::Span print_span("PrintRouteResponse", "stat_request");
+  return PrintRouteResponse(std::move(route_stats), request.id);
+}
+
+Json::Node Visitor::Visit(const StatRequest& request) const {
+  return visit([this](const auto& typed_request) { return Visit(typed_request); }, request);
 }
 
 void Visitor::Visit(const ModifyBusRequest& request) const {
+  Metrics::LatencyTimer timer(modify_bus_latency);
+  Trace::Span span("ModifyBusRequest", "base_request");
+  span.Arg("name", request.bus_name).Arg("stop_count", static_cast<int>(request.stops.size()));
   if(request.cycle) {
 	rm->SetStrategy(cycle_strategy.get());
   } else {
@@ -195,6 +415,9 @@ void Visitor::Visit(const ModifyBusRequest& request) const {
   rm->SetBusData(request.bus_name, request.stops);
 }
 void Visitor::Visit(const ModifyStopRequest& request) const {
+  Metrics::LatencyTimer timer(modify_stop_latency);
+  Trace::Span span("ModifyStopRequest", "base_request");
+  span.Arg("name", request.stop_name);
   rm->SetStopData(request.stop_name, Coords{request.latitude, request.longitude},
 		  request.distances);
 }
@@ -204,6 +427,13 @@ void Visitor::SetRouteManager(RouteManager* rm_) {
 }
 
 Visitor::Visitor() {
+  Metrics::Registry& registry = Metrics::Registry::Global();
+  bus_latency = registry.GetHistogram("bus_request");
+  stop_latency = registry.GetHistogram("stop_request");
+  route_latency = registry.GetHistogram("route_request");
+  route_print_latency = registry.GetHistogram("route_print");
+  modify_bus_latency = registry.GetHistogram("modify_bus_request");
+  modify_stop_latency = registry.GetHistogram("modify_stop_request");
   cycle_strategy = make_unique<CycleStrategy>();
   not_cycle_strategy = make_unique<NotCycleStrategy>();
 }
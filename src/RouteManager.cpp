@@ -2,6 +2,11 @@
 #include <sstream>
 #include "test_runner.h"
 #include <iomanip>
+#include <random>
+#include <limits>
+#include <algorithm>
+#include <utility>
+#include "serialization.h"
 using namespace std;
 
 double Strategy::ComputeDistance(const Coords& lhs, const Coords& rhs) const {
@@ -12,9 +17,238 @@ double Strategy::ComputeDistance(const Coords& lhs, const Coords& rhs) const {
 		      6371000;
 }
 
-int Strategy::ComputeUniqueStopsOnRoute(const std::vector<std::string>& stops) const {
-  std::set<std::string> s(begin(stops), end(stops));
-  return s.size();
+int Strategy::ComputeUniqueStopsOnRoute(const std::vector<StopId>& stops) const {
+  std::vector<StopId> unique_stops(begin(stops), end(stops));
+  sort(begin(unique_stops), end(unique_stops));
+  return unique(begin(unique_stops), end(unique_stops)) - begin(unique_stops);
+}
+
+void RouteManager::Serialize(std::ostream& output) {
+  using namespace Serialization;
+  BuildRouterIfNotExists();
+  const std::streampos snapshot_begin = output.tellp();
+  WriteValue(output, SNAPSHOT_MAGIC);
+  WriteValue(output, SNAPSHOT_VERSION);
+
+  WriteValue<int32_t>(output, settings.bus_wait_time);
+  WriteValue(output, settings.bus_velocity);
+  WriteValue<uint8_t>(output, static_cast<uint8_t>(settings.router_type));
+  WriteValue<uint64_t>(output, settings.thread_count);
+  WriteValue<uint8_t>(output, static_cast<uint8_t>(settings.graph_model));
+  WriteValue<uint64_t>(output, settings.route_cache_bytes);
+
+  WriteValue<uint32_t>(output, bus_stats.size());
+  for(BusId bus_id = 0; bus_id < bus_stats.size(); ++bus_id) {
+	WriteString(output, bus_names[bus_id]);
+	const BusStats& stats = bus_stats[bus_id];
+	WriteValue<int32_t>(output, stats.stop_count);
+	WriteValue<int32_t>(output, stats.unique_stop_count);
+	WriteValue<double>(output, stats.route_distance);
+	WriteValue<double>(output, stats.curvature);
+  }
+
+  WriteValue<uint32_t>(output, stop_db.size());
+  for(const StopDataBase& stop: stop_db) {
+	WriteString(output, stop.GetName());
+	// The coordinates come from double values, so double keeps them exactly.
+	WriteValue<double>(output, stop.GetCoords().latitude);
+	WriteValue<double>(output, stop.GetCoords().longitude);
+	WriteValue<uint64_t>(output, stop.GetVertexId());
+	WriteValue<uint64_t>(output, stop.GetBoardingVertexId());
+	WriteValue<uint32_t>(output, stop.GetBuses().size());
+	for(string_view bus_name: stop.GetBuses()) {
+	  WriteValue<uint32_t>(output, bus_ids.at(bus_name));
+	}
+	WriteValue<uint32_t>(output, stop.GetDistances().size());
+	for(const auto& [stop_id, distance]: stop.GetDistances()) {
+	  WriteValue<uint32_t>(output, stop_id);
+	  WriteValue<int32_t>(output, distance);
+	}
+  }
+  WriteValue<uint64_t>(output, vertex_counter);
+
+  // Names of route items are stored as ids, an empty name as NO_ID.
+  WriteValue<uint64_t>(output, edge_to_element.size());
+  for(const ElementOfRoute& element: edge_to_element) {
+	WriteValue<uint32_t>(output, element.bus_name.empty() ? NO_ID : bus_ids.at(element.bus_name));
+	WriteValue<int32_t>(output, element.span_count);
+	WriteValue<uint32_t>(output, element.start_stop_name.empty() ? NO_ID :
+		stop_ids.at(element.start_stop_name));
+	WriteValue(output, element.el_time);
+  }
+
+  // The graph edges and the router table are the bulk of the snapshot and are
+  // used in place by Deserialize, so they go last as aligned arrays.
+  vector<Graph::Edge<double>> edges;
+  edges.reserve(graph->GetEdgeCount());
+  for(Graph::EdgeId edge_id = 0; edge_id < graph->GetEdgeCount(); ++edge_id) {
+	edges.push_back(std::as_const(*graph).GetEdge(edge_id));
+  }
+  const size_t vertex_count = graph->GetVertexCount();
+  WriteValue<uint64_t>(output, vertex_count);
+  WriteArray(output, snapshot_begin, edges.data(), edges.size());
+
+  if(settings.router_type == RouterType::FLOYD_WARSHALL) {
+	const auto& table = static_cast<const Graph::Router<double>&>(*router);
+	WriteArray(output, snapshot_begin, table.GetWeights(), vertex_count * vertex_count);
+	WriteArray(output, snapshot_begin, table.GetPrevEdges(), vertex_count * vertex_count);
+  }
+  if(!output) {
+	throw runtime_error("cannot write snapshot");
+  }
+}
+
+unique_ptr<RouteManager> RouteManager::Deserialize(Serialization::SnapshotData snapshot) {
+  Serialization::Reader input(snapshot.GetData());
+  if(input.ReadValue<uint32_t>() != SNAPSHOT_MAGIC) {
+	throw runtime_error("not a route manager snapshot");
+  }
+  if(const uint32_t version = input.ReadValue<uint32_t>(); version != SNAPSHOT_VERSION) {
+	throw runtime_error("unsupported snapshot version " + to_string(version));
+  }
+
+  RoutingSettings settings{input.ReadValue<int32_t>(), input.ReadValue<double>()};
+  settings.router_type = static_cast<RouterType>(input.ReadValue<uint8_t>());
+  settings.thread_count = input.ReadValue<uint64_t>();
+  settings.graph_model = static_cast<GraphModel>(input.ReadValue<uint8_t>());
+  settings.route_cache_bytes = input.ReadValue<uint64_t>();
+  auto rm = make_unique<RouteManager>(settings);
+
+  // Counts are checked against the smallest record they can describe: a name
+  // length for a bus, a name length and two list lengths for a stop.
+  const uint32_t bus_count = input.ReadCount<uint32_t>(sizeof(uint32_t));
+  for(BusId bus_id = 0; bus_id < bus_count; ++bus_id) {
+	const string_view bus_name = rm->names.Store(input.ReadString());
+	rm->bus_ids.emplace(bus_name, bus_id);
+	rm->bus_names.push_back(bus_name);
+	BusStats& stats = rm->bus_stats.emplace_back();
+	stats.stop_count = input.ReadValue<int32_t>();
+	stats.unique_stop_count = input.ReadValue<int32_t>();
+	stats.route_distance = input.ReadValue<double>();
+	stats.curvature = input.ReadValue<double>();
+  }
+  auto read_bus_name = [&rm, &input]() -> string_view {
+	const uint32_t bus_id = input.ReadValue<uint32_t>();
+	if(bus_id == NO_ID) {
+	  return {};
+	}
+	if(bus_id >= rm->bus_names.size()) {
+	  throw runtime_error("snapshot refers to a missing bus");
+	}
+	return rm->bus_names[bus_id];
+  };
+
+  const uint32_t stop_count = input.ReadCount<uint32_t>(3 * sizeof(uint32_t));
+  rm->stop_db.reserve(stop_count);
+  for(StopId stop_id = 0; stop_id < stop_count; ++stop_id) {
+	StopDataBase& stop = rm->stop_db.emplace_back();
+	stop.SetName(rm->names.Store(input.ReadString()));
+	rm->stop_ids.emplace(stop.GetName(), stop_id);
+	const double latitude = input.ReadValue<double>();
+	stop.SetCoords(Coords{latitude, input.ReadValue<double>()});
+	stop.SetVertexId(input.ReadValue<uint64_t>());
+	stop.SetBoardingVertexId(input.ReadValue<uint64_t>());
+	for(uint32_t count = input.ReadValue<uint32_t>(); count > 0; --count) {
+	  stop.GetBuses().insert(read_bus_name());
+	}
+	for(uint32_t count = input.ReadValue<uint32_t>(); count > 0; --count) {
+	  const StopId to_id = input.ReadValue<uint32_t>();
+	  if(to_id >= stop_count) {
+		throw runtime_error("snapshot has a distance to a missing stop");
+	  }
+	  stop.SetDistance(to_id, input.ReadValue<int32_t>());
+	}
+  }
+  rm->vertex_counter = input.ReadValue<uint64_t>();
+
+  const size_t element_count = input.ReadCount<uint64_t>(3 * sizeof(uint32_t) + sizeof(double));
+  rm->edge_to_element.reserve(element_count);
+  for(size_t idx = 0; idx < element_count; ++idx) {
+	ElementOfRoute element;
+	element.bus_name = read_bus_name();
+	element.span_count = input.ReadValue<int32_t>();
+	const uint32_t stop_id = input.ReadValue<uint32_t>();
+	if(stop_id != NO_ID && stop_id >= stop_count) {
+	  throw runtime_error("snapshot has a route item at a missing stop");
+	}
+	element.start_stop_name = stop_id == NO_ID ? string_view() : rm->stop_db[stop_id].GetName();
+	element.el_time = input.ReadValue<double>();
+	rm->edge_to_element.push_back(element);
+  }
+
+  const size_t vertex_count = input.ReadValue<uint64_t>();
+  if(vertex_count != 0 && vertex_count > numeric_limits<size_t>::max() / vertex_count) {
+	throw runtime_error("snapshot vertex count is too large");
+  }
+  for(const StopDataBase& stop: rm->stop_db) {
+	if((stop.HasVertexId() && stop.GetVertexId() >= vertex_count) ||
+		(stop.HasBoardingVertexId() && stop.GetBoardingVertexId() >= vertex_count)) {
+	  throw runtime_error("snapshot has a stop at a missing vertex");
+	}
+  }
+  const auto [edges, edge_count] = input.ReadArray<Graph::Edge<double>>();
+  if(rm->edge_to_element.size() != edge_count) {
+	throw runtime_error("snapshot route items do not match the graph edges");
+  }
+  // Every vertex is a stop or boarding vertex, a ride vertex with an edge or
+  // the lone ride vertex of a one-stop run, at most two of those per bus.
+  if(vertex_count > 2 * (static_cast<size_t>(stop_count) + bus_count) + edge_count) {
+	throw runtime_error("snapshot has more vertices than its network");
+  }
+  for(size_t idx = 0; idx < edge_count; ++idx) {
+	if(edges[idx].from >= vertex_count || edges[idx].to >= vertex_count) {
+	  throw runtime_error("snapshot has an edge to a missing vertex");
+	}
+	if(idx > 0 && edges[idx - 1].from > edges[idx].from) {
+	  throw runtime_error("snapshot edges are not sorted by source vertex");
+	}
+  }
+  rm->graph = make_unique<Graph::DirectedWeightedGraph<double>>(vertex_count, edges, edge_count);
+
+  RouterHolder router;
+  switch(settings.router_type) {
+	case RouterType::DIJKSTRA:
+	  router = make_unique<Graph::DijkstraRouter<double>>(*rm->graph);
+	  break;
+	case RouterType::FLOYD_WARSHALL: {
+	  const auto [weights, weight_count] = input.ReadArray<float>();
+	  const auto [prev_edges, prev_edge_count] = input.ReadArray<uint32_t>();
+	  if(weight_count != vertex_count * vertex_count || prev_edge_count != vertex_count * vertex_count) {
+		throw runtime_error("snapshot router table does not match the graph");
+	  }
+	  auto table_router = make_unique<Graph::Router<double>>(*rm->graph, weights, prev_edges);
+	  if(!table_router->HasValidRoutes()) {
+		throw runtime_error("snapshot router table has a broken route");
+	  }
+	  router = move(table_router);
+	  break;
+	}
+	default:
+	  throw runtime_error("snapshot has an unknown router type");
+  }
+  call_once(rm->router_once, [&rm, &router] {
+	rm->router = move(router);
+  });
+  rm->snapshot = move(snapshot);
+  return rm;
+}
+
+void RouteManager::RecordMetrics(Metrics::Registry& registry) const {
+  registry.SetCounter("stops", stop_db.size());
+  registry.SetCounter("buses", bus_stats.size());
+  if(graph) {
+	registry.SetCounter("graph_vertices", graph->GetVertexCount());
+	registry.SetCounter("graph_edges", graph->GetEdgeCount());
+  }
+  registry.SetCounter("deduplicated_edges", deduplicated_edge_count);
+  if(router) {
+	registry.SetCounter("router_table_bytes", router->GetTableBytes());
+  }
+  const RouteCache::Stats cache_stats = route_cache.GetStats();
+  registry.SetCounter("route_cache_hits", cache_stats.hits);
+  registry.SetCounter("route_cache_misses", cache_stats.misses);
+  registry.SetCounter("route_cache_evictions", cache_stats.evictions);
+  registry.SetCounter("route_cache_bytes", cache_stats.size_bytes);
 }
 
 void TestComputeDistance() {
@@ -107,3 +341,378 @@ void TestStopStats() {
   }
 }
 
+
+namespace {
+const vector<string> SAMPLE_STOP_NAMES = {"Biryulyovo Zapadnoye", "Biryulyovo Tovarnaya",
+	"Universam", "Prazhskaya"};
+
+// The data is local on purpose: RouteManager must not keep views into it.
+void FillSampleNetwork(RouteManager& manager) {
+  const vector<DistanceToStop> v1 = vector<DistanceToStop>({{2600, "Biryulyovo Tovarnaya"}});
+  const vector<DistanceToStop> v2 = vector<DistanceToStop>({{890, "Universam"}});
+  const vector<DistanceToStop> v3 = vector<DistanceToStop>({{4650, "Prazhskaya"},
+	  {2500, "Biryulyovo Zapadnoye"}, {1380, "Biryulyovo Tovarnaya"}});
+  const vector<string> stops_297 = {"Biryulyovo Zapadnoye", "Biryulyovo Tovarnaya",
+	  "Universam", "Biryulyovo Zapadnoye"};
+  const vector<string> stops_635 = {"Biryulyovo Tovarnaya", "Universam", "Prazhskaya"};
+  CycleStrategy cycle;
+  NotCycleStrategy not_cycle;
+
+  manager.SetStopData(SAMPLE_STOP_NAMES[0], Coords{55.574371 * 3.1415926535 / 180,
+	  37.6517 * 3.1415926535 / 180}, v1);
+  manager.SetStopData(SAMPLE_STOP_NAMES[1], Coords{55.592028 * 3.1415926535 / 180,
+	  37.653656 * 3.1415926535 / 180}, v2);
+  manager.SetStopData(SAMPLE_STOP_NAMES[2], Coords{55.587655 * 3.1415926535 / 180,
+	  37.645687 * 3.1415926535 / 180}, v3);
+  manager.SetStopData(SAMPLE_STOP_NAMES[3], Coords{55.611717 * 3.1415926535 / 180,
+	  37.603938 * 3.1415926535 / 180}, {});
+  manager.SetStrategy(&cycle);
+  manager.SetBusData("297", stops_297);
+  manager.SetStrategy(&not_cycle);
+  manager.SetBusData("635", stops_635);
+}
+
+void AssertSameRoutes(RouteManager& expected_manager, RouteManager& actual_manager) {
+  for(const string& from: SAMPLE_STOP_NAMES) {
+	for(const string& to: SAMPLE_STOP_NAMES) {
+	  auto expected = expected_manager.GetRouteStats(from, to);
+	  auto actual = actual_manager.GetRouteStats(from, to);
+	  ASSERT_EQUAL(expected != nullptr, actual != nullptr);
+	  if(!expected) {
+		continue;
+	  }
+	  ASSERT(abs(expected->weight - actual->weight) < 1e-9);
+	  double items_time = 0;
+	  for(const ElementOfRoute& element: actual->elements_of_route) {
+		ASSERT(!element.bus_name.empty());
+		ASSERT(element.span_count > 0);
+		items_time += element.el_time + actual->bus_wait_time;
+	  }
+	  ASSERT(abs(items_time - actual->weight) < 1e-9);
+	}
+  }
+}
+}
+
+void TestDijkstraRouter() {
+  RouteManager floyd_warshall(RoutingSettings{6, 40, RouterType::FLOYD_WARSHALL});
+  RouteManager dijkstra(RoutingSettings{6, 40, RouterType::DIJKSTRA});
+  FillSampleNetwork(floyd_warshall);
+  FillSampleNetwork(dijkstra);
+  AssertSameRoutes(floyd_warshall, dijkstra);
+}
+
+void TestTransitGraphModel() {
+  RouteManager stop_to_stop(RoutingSettings{6, 40});
+  RouteManager transit(RoutingSettings{6, 40, RouterType::DIJKSTRA, 1, GraphModel::TRANSIT});
+  FillSampleNetwork(stop_to_stop);
+  FillSampleNetwork(transit);
+  AssertSameRoutes(stop_to_stop, transit);
+
+  auto route = transit.GetRouteStats("Biryulyovo Zapadnoye", "Universam");
+  ASSERT_EQUAL(route->elements_of_route.size(), 1u);
+  ASSERT_EQUAL(route->elements_of_route[0].bus_name, "297");
+  ASSERT_EQUAL(route->elements_of_route[0].span_count, 2);
+  ASSERT_EQUAL(route->elements_of_route[0].start_stop_name, "Biryulyovo Zapadnoye");
+}
+
+void TestBlockedFloydWarshall() {
+  const size_t vertex_count = 130;
+  Graph::DirectedWeightedGraph<double> graph(vertex_count);
+  mt19937 generator(42);
+  for(size_t i = 0; i < 4 * vertex_count; ++i) {
+	const Graph::VertexId from = generator() % vertex_count;
+	const Graph::VertexId to = generator() % vertex_count;
+	if(from != to) {
+	  // Small integer weights make plenty of equal-weight alternatives.
+	  graph.AddEdge({from, to, static_cast<double>(generator() % 5 + 1)});
+	}
+  }
+
+  // Plain k-i-j Floyd–Warshall with the same tie rules as Router.
+  const float inf = numeric_limits<float>::infinity();
+  const uint32_t no_edge = numeric_limits<uint32_t>::max();
+  vector<float> weights(vertex_count * vertex_count, inf);
+  vector<uint32_t> prev_edges(vertex_count * vertex_count, no_edge);
+  for(size_t v = 0; v < vertex_count; ++v) {
+	weights[v * vertex_count + v] = 0;
+	for(Graph::EdgeId edge_id: graph.GetIncidentEdges(v)) {
+	  const auto& edge = graph.GetEdge(edge_id);
+	  if(weights[v * vertex_count + edge.to] > edge.weight) {
+		weights[v * vertex_count + edge.to] = edge.weight;
+		prev_edges[v * vertex_count + edge.to] = edge_id;
+	  }
+	}
+  }
+  for(size_t k = 0; k < vertex_count; ++k) {
+	for(size_t i = 0; i < vertex_count; ++i) {
+	  for(size_t j = 0; j < vertex_count; ++j) {
+		const float candidate = weights[i * vertex_count + k] + weights[k * vertex_count + j];
+		if(candidate < weights[i * vertex_count + j]) {
+		  weights[i * vertex_count + j] = candidate;
+		  prev_edges[i * vertex_count + j] = prev_edges[k * vertex_count + j];
+		}
+	  }
+	}
+  }
+
+  // Freezing renumbers the edges; the CSR arrays must describe the same edges.
+  const vector<Graph::EdgeId> new_edge_ids = graph.Freeze();
+  // Edges of a frozen graph are read through the const overload.
+  const Graph::DirectedWeightedGraph<double>& frozen_graph = graph;
+  for(uint32_t& edge_id: prev_edges) {
+	if(edge_id != no_edge) {
+	  edge_id = new_edge_ids[edge_id];
+	}
+  }
+  ASSERT_EQUAL(graph.GetOutEdgesBegin(0), 0u);
+  ASSERT_EQUAL(graph.GetOutEdgesEnd(vertex_count - 1), graph.GetEdgeCount());
+  for(size_t v = 0; v < vertex_count; ++v) {
+	for(Graph::EdgeId edge_id = graph.GetOutEdgesBegin(v); edge_id < graph.GetOutEdgesEnd(v); ++edge_id) {
+	  ASSERT_EQUAL(frozen_graph.GetEdge(edge_id).from, v);
+	  ASSERT_EQUAL(frozen_graph.GetEdge(edge_id).to, graph.GetEdgeTarget(edge_id));
+	  ASSERT_EQUAL(frozen_graph.GetEdge(edge_id).weight, graph.GetEdgeWeight(edge_id));
+	}
+  }
+
+  for(size_t thread_count: {1, 4}) {
+	Graph::Router<double> router(graph, thread_count);
+	vector<Graph::EdgeId> actual;
+	for(size_t from = 0; from < vertex_count; ++from) {
+	  for(size_t to = 0; to < vertex_count; ++to) {
+		auto route = router.BuildRoute(from, to, actual);
+		ASSERT_EQUAL(route.has_value(), weights[from * vertex_count + to] != inf);
+		if(!route) {
+		  continue;
+		}
+		vector<Graph::EdgeId> expected;
+		for(uint32_t edge_id = prev_edges[from * vertex_count + to]; edge_id != no_edge;
+			edge_id = prev_edges[from * vertex_count + frozen_graph.GetEdge(edge_id).from]) {
+		  expected.push_back(edge_id);
+		}
+		reverse(begin(expected), end(expected));
+		ASSERT_EQUAL(route->edge_count, expected.size());
+		ASSERT_EQUAL(actual, expected);
+		vector<Graph::EdgeId> visited;
+		const auto weight = router.VisitRoute(from, to, [&visited](Graph::EdgeId edge_id) {
+		  visited.push_back(edge_id);
+		});
+		ASSERT_EQUAL(*weight, route->weight);
+		ASSERT_EQUAL(visited, expected);
+	  }
+	}
+  }
+}
+
+void TestMinPlusKernels() {
+  vector<Graph::MinPlusRowKernel> kernels = {Graph::MIN_PLUS_ROW};
+#ifdef GRAPH_MIN_PLUS_X86
+  kernels.push_back(Graph::MinPlusRowSse2);
+  if(__builtin_cpu_supports("avx2")) {
+	kernels.push_back(Graph::MinPlusRowAvx2);
+  }
+#endif
+  const float inf = numeric_limits<float>::infinity();
+  mt19937 generator(7);
+  const size_t count = 61;
+  vector<float> weights_through(count), weights(count);
+  vector<uint32_t> prev_edges_through(count), prev_edges(count);
+  for(size_t idx = 0; idx < count; ++idx) {
+	weights_through[idx] = generator() % 4 == 0 ? inf : generator() % 10 + 0.1f * idx;
+	weights[idx] = generator() % 3 == 0 ? inf : generator() % 20 + 0.1f * idx;
+	prev_edges_through[idx] = generator();
+	prev_edges[idx] = generator();
+  }
+
+  vector<float> expected_weights = weights;
+  vector<uint32_t> expected_prev_edges = prev_edges;
+  Graph::MinPlusRowScalar(5, count, weights_through.data(), prev_edges_through.data(),
+	  expected_weights.data(), expected_prev_edges.data());
+
+  for(Graph::MinPlusRowKernel kernel: kernels) {
+	vector<float> actual_weights = weights;
+	vector<uint32_t> actual_prev_edges = prev_edges;
+	kernel(5, count, weights_through.data(), prev_edges_through.data(),
+		actual_weights.data(), actual_prev_edges.data());
+	ASSERT_EQUAL(actual_weights, expected_weights);
+	ASSERT_EQUAL(actual_prev_edges, expected_prev_edges);
+  }
+}
+
+void TestEdgeIndex() {
+  Graph::EdgeIndex index;
+  for(size_t i = 0; i < 1000; ++i) {
+	ASSERT(index.Emplace(i % 37, i, i).second);
+  }
+  ASSERT_EQUAL(index.Size(), 1000u);
+  for(size_t i = 0; i < 1000; ++i) {
+	const auto [edge_id, inserted] = index.Emplace(i % 37, i, 5000 + i);
+	ASSERT(!inserted);
+	ASSERT_EQUAL(edge_id, i);
+  }
+  ASSERT(index.Emplace(1, 0, 7).second);
+  ASSERT_EQUAL(index.GetDuplicateCount(), 1000u);
+  index.Clear();
+  ASSERT_EQUAL(index.Size(), 0u);
+  ASSERT_EQUAL(index.GetDuplicateCount(), 1000u);
+  ASSERT(index.Emplace(0, 0, 1).second);
+}
+
+void TestStringPool() {
+  StringPool pool;
+  string short_str = "Biryulyovo Zapadnoye";
+  string long_str(StringPool::BLOCK_SIZE, 'x');
+  const string_view short_view = pool.Store(short_str);
+  const string_view long_view = pool.Store(long_str);
+  ASSERT(short_view.data() != short_str.data());
+  short_str.assign("Universam");
+  long_str.clear();
+  for(int i = 0; i < 10000; ++i) {
+	pool.Store(to_string(i));
+  }
+  ASSERT_EQUAL(short_view, "Biryulyovo Zapadnoye"sv);
+  ASSERT_EQUAL(long_view, string(StringPool::BLOCK_SIZE, 'x'));
+  ASSERT(pool.Store("").empty());
+
+  RouteManager manager(RoutingSettings{6, 40});
+  FillSampleNetwork(manager);
+  ASSERT_EQUAL(manager.GetBusStats("297")->stop_count, 4);
+  ASSERT_EQUAL(*manager.GetStopStats("Universam"), set<string_view>({"297", "635"}));
+  const auto route = manager.GetRouteStats("Biryulyovo Zapadnoye", "Prazhskaya");
+  ASSERT(route != nullptr);
+  ASSERT_EQUAL(route->elements_of_route.front().start_stop_name, "Biryulyovo Zapadnoye"sv);
+}
+
+void TestSnapshot() {
+  for(const RouterType router_type: {RouterType::FLOYD_WARSHALL, RouterType::DIJKSTRA}) {
+	for(const GraphModel graph_model: {GraphModel::STOP_TO_STOP, GraphModel::TRANSIT}) {
+	  RouteManager manager(RoutingSettings{6, 40, router_type, 1, graph_model});
+	  FillSampleNetwork(manager);
+	  stringstream snapshot;
+	  manager.Serialize(snapshot);
+	  const auto restored = RouteManager::Deserialize(Serialization::SnapshotData::FromStream(snapshot));
+
+	  ASSERT(restored->GetRoutingSettings().router_type == router_type);
+	  ASSERT(restored->GetRoutingSettings().graph_model == graph_model);
+	  for(const string bus_name: {"297", "635", "750"}) {
+		const auto expected = manager.GetBusStats(bus_name);
+		const auto actual = restored->GetBusStats(bus_name);
+		ASSERT_EQUAL(expected.has_value(), actual.has_value());
+		if(expected) {
+		  ASSERT_EQUAL(expected->stop_count, actual->stop_count);
+		  ASSERT_EQUAL(expected->unique_stop_count, actual->unique_stop_count);
+		  ASSERT_EQUAL(expected->route_distance, actual->route_distance);
+		  ASSERT_EQUAL(expected->curvature, actual->curvature);
+		}
+	  }
+	  for(const string& stop_name: SAMPLE_STOP_NAMES) {
+		ASSERT_EQUAL(*manager.GetStopStats(stop_name), *restored->GetStopStats(stop_name));
+	  }
+	  AssertSameRoutes(manager, *restored);
+	  // Every field is written on its own, so the bytes only depend on the network.
+	  stringstream saved_again;
+	  restored->Serialize(saved_again);
+	  ASSERT(saved_again.str() == snapshot.str());
+	}
+  }
+
+  stringstream broken("not a snapshot");
+  bool thrown = false;
+  try {
+	RouteManager::Deserialize(Serialization::SnapshotData::FromStream(broken));
+  } catch(const runtime_error&) {
+	thrown = true;
+  }
+  ASSERT(thrown);
+
+  // The tail of a Floyd–Warshall snapshot is the previous edge table.
+  RouteManager manager(RoutingSettings{6, 40});
+  FillSampleNetwork(manager);
+  stringstream snapshot;
+  manager.Serialize(snapshot);
+  string corrupted = snapshot.str();
+  fill(end(corrupted) - 64, end(corrupted), '\x7f');
+  stringstream corrupted_stream(corrupted);
+  thrown = false;
+  try {
+	RouteManager::Deserialize(Serialization::SnapshotData::FromStream(corrupted_stream));
+  } catch(const runtime_error&) {
+	thrown = true;
+  }
+  ASSERT(thrown);
+
+  // Any single damaged byte is either rejected or still answers every query.
+  const string original = snapshot.str();
+  for(size_t pos = 0; pos < original.size(); ++pos) {
+	for(const char byte: {'\x00', '\x01', '\x7f', '\xff'}) {
+	  string damaged = original;
+	  damaged[pos] = byte;
+	  stringstream damaged_stream(damaged);
+	  unique_ptr<RouteManager> restored;
+	  try {
+		restored = RouteManager::Deserialize(Serialization::SnapshotData::FromStream(damaged_stream));
+	  } catch(const runtime_error&) {
+		continue;
+	  }
+	  for(const string& from: SAMPLE_STOP_NAMES) {
+		for(const string& to: SAMPLE_STOP_NAMES) {
+		  restored->GetRouteStats(from, to);
+		}
+	  }
+	}
+  }
+}
+
+void TestRouteCache() {
+  using Cache = LruCache<int, string>;
+  const size_t entry_bytes = 100;
+  Cache probe(1000);
+  probe.Put(0, make_shared<string>("0"), entry_bytes);
+  const size_t entry_overhead = probe.GetStats().size_bytes - entry_bytes;
+
+  Cache cache(3 * (entry_bytes + entry_overhead));
+  for(int key = 0; key < 3; ++key) {
+	cache.Put(key, make_shared<string>(to_string(key)), entry_bytes);
+  }
+  const Cache::ValuePtr zero = cache.Get(0);
+  ASSERT_EQUAL(*zero, "0");
+  cache.Put(3, make_shared<string>("3"), entry_bytes);
+  ASSERT(cache.Get(1) == nullptr);
+  ASSERT_EQUAL(*cache.Get(0), "0");
+  ASSERT_EQUAL(*cache.Get(3), "3");
+  ASSERT(cache.Put(0, make_shared<string>("other"), entry_bytes) == zero);
+  Cache::Stats stats = cache.GetStats();
+  ASSERT_EQUAL(stats.hits, 3u);
+  ASSERT_EQUAL(stats.misses, 1u);
+  ASSERT_EQUAL(stats.evictions, 1u);
+  ASSERT_EQUAL(stats.entry_count, 3u);
+  ASSERT_EQUAL(stats.size_bytes, 3 * (entry_bytes + entry_overhead));
+
+  RoutingSettings settings{6, 40};
+  settings.route_cache_bytes = 0;
+  RouteManager uncached(settings);
+  RouteManager cached(RoutingSettings{6, 40});
+  FillSampleNetwork(uncached);
+  FillSampleNetwork(cached);
+  AssertSameRoutes(uncached, cached);
+  const auto first = cached.GetRouteStats("Biryulyovo Zapadnoye", "Prazhskaya");
+  ASSERT(first == cached.GetRouteStats("Biryulyovo Zapadnoye", "Prazhskaya"));
+  ASSERT(uncached.GetRouteCacheStats().hits == 0);
+  ASSERT(uncached.GetRouteCacheStats().entry_count == 0);
+  ASSERT(cached.GetRouteCacheStats().hits > 0);
+}
+
+void TestRoadDistanceOnlyStop() {
+  for(const RouterType router_type: {RouterType::FLOYD_WARSHALL, RouterType::DIJKSTRA}) {
+	for(const GraphModel graph_model: {GraphModel::STOP_TO_STOP, GraphModel::TRANSIT}) {
+	  RouteManager manager(RoutingSettings{6, 40, router_type, 1, graph_model});
+	  manager.SetStopData("Elsewhere", Coords{55.574371 * 3.1415926535 / 180,
+		  37.6517 * 3.1415926535 / 180}, {{1000, "Nowhere"}});
+	  FillSampleNetwork(manager);
+	  ASSERT(manager.GetRouteStats("Nowhere", "Universam") == nullptr);
+	  ASSERT(manager.GetRouteStats("Universam", "Nowhere") == nullptr);
+	  ASSERT(manager.GetRouteStats("Nowhere", "Nowhere") == nullptr);
+	  ASSERT(manager.GetRouteStats("Biryulyovo Zapadnoye", "Universam") != nullptr);
+	}
+  }
+}
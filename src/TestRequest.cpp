@@ -2,54 +2,333 @@
 #include <iomanip>
 #include "test_runner.h"
 #include <fstream>
+#include "metrics.h"
+#include "trace.h"
 
 using namespace std;
 
 void TestModifyAndReadRequest() {
   ifstream input("input.json");
-  Json::Document doc = Json::Load(input);
+  const Json::CompactDocument doc = Json::LoadCompact(input);
   JsonParser jp;
   {
-	const auto requests = jp.ParseBaseRequests(doc);
+	const BaseRequests requests = jp.ParseBaseRequests(doc);
 
-	ASSERT_EQUAL(static_cast<ModifyStopRequest&>(*requests[2]).latitude, 3.1415926535 * 55.574371 / 180);
-	ASSERT_EQUAL(static_cast<ModifyStopRequest&>(*requests[2]).longitude, 3.1415926535 * 37.6517 / 180);
-	ASSERT_EQUAL(static_cast<ModifyStopRequest&>(*requests[2]).stop_name, "Biryulyovo Zapadnoye");
+	ASSERT_EQUAL(requests.stops[0].latitude, 3.1415926535 * 55.574371 / 180);
+	ASSERT_EQUAL(requests.stops[0].longitude, 3.1415926535 * 37.6517 / 180);
+	ASSERT_EQUAL(requests.stops[0].stop_name, "Biryulyovo Zapadnoye");
 
-	ASSERT_EQUAL(static_cast<ModifyStopRequest&>(*requests[3]).latitude, 3.1415926535 * 55.587655 / 180);
-	ASSERT_EQUAL(static_cast<ModifyStopRequest&>(*requests[3]).longitude, 3.1415926535 * 37.645687 / 180);
-	ASSERT_EQUAL(static_cast<ModifyStopRequest&>(*requests[3]).stop_name, "Universam");
+	ASSERT_EQUAL(requests.stops[1].latitude, 3.1415926535 * 55.587655 / 180);
+	ASSERT_EQUAL(requests.stops[1].longitude, 3.1415926535 * 37.645687 / 180);
+	ASSERT_EQUAL(requests.stops[1].stop_name, "Universam");
 
 
-	ASSERT_EQUAL(static_cast<ModifyBusRequest&>(*requests[0]).cycle, true);
-	ASSERT_EQUAL(static_cast<ModifyBusRequest&>(*requests[0]).bus_name, "297");
-	ASSERT_EQUAL(static_cast<ModifyBusRequest&>(*requests[0]).stops,
+	ASSERT_EQUAL(requests.buses[0].cycle, true);
+	ASSERT_EQUAL(requests.buses[0].bus_name, "297");
+	ASSERT_EQUAL(requests.buses[0].stops,
 	vector<string>({"Biryulyovo Zapadnoye", "Biryulyovo Tovarnaya",
 		"Universam", "Biryulyovo Zapadnoye"}));
 
-	ASSERT_EQUAL(static_cast<ModifyBusRequest&>(*requests[1]).cycle, false);
-	ASSERT_EQUAL(static_cast<ModifyBusRequest&>(*requests[1]).bus_name, "635");
-	ASSERT_EQUAL(static_cast<ModifyBusRequest&>(*requests[1]).stops,
+	ASSERT_EQUAL(requests.buses[1].cycle, false);
+	ASSERT_EQUAL(requests.buses[1].bus_name, "635");
+	ASSERT_EQUAL(requests.buses[1].stops,
 	vector<string>({"Biryulyovo Tovarnaya", "Universam", "Prazhskaya"}));
   }
   {
 	const auto requests = jp.ParseStatRequests(doc);
 
-	ASSERT_EQUAL(static_cast<ReadBusRequest&>(*requests[0]).bus_name, "297");
-	ASSERT_EQUAL(static_cast<ReadBusRequest&>(*requests[0]).id, 1);
+	ASSERT_EQUAL(get<ReadBusRequest>(requests[0]).bus_name, "297");
+	ASSERT_EQUAL(get<ReadBusRequest>(requests[0]).id, 1);
 
 
-	ASSERT_EQUAL(static_cast<ReadBusRequest&>(*requests[1]).bus_name, "635");
-	ASSERT_EQUAL(static_cast<ReadBusRequest&>(*requests[1]).id, 2);
+	ASSERT_EQUAL(get<ReadBusRequest>(requests[1]).bus_name, "635");
+	ASSERT_EQUAL(get<ReadBusRequest>(requests[1]).id, 2);
 
 
-	ASSERT_EQUAL(static_cast<ReadStopRequest&>(*requests[2]).id, 3);
-	ASSERT_EQUAL(static_cast<ReadStopRequest&>(*requests[2]).stop_name, "Universam");
+	ASSERT_EQUAL(get<ReadStopRequest>(requests[2]).id, 3);
+	ASSERT_EQUAL(get<ReadStopRequest>(requests[2]).stop_name, "Universam");
+	ASSERT_EQUAL(requests[2].index(), static_cast<size_t>(RequestType::READ_STOP));
 
 
-	ASSERT_EQUAL(static_cast<ReadRouteRequest&>(*requests[3]).id, 4);
-	ASSERT_EQUAL(static_cast<ReadRouteRequest&>(*requests[3]).from, "Biryulyovo Zapadnoye");
-	ASSERT_EQUAL(static_cast<ReadRouteRequest&>(*requests[3]).to, "Universam");
+	ASSERT_EQUAL(get<ReadRouteRequest>(requests[3]).id, 4);
+	ASSERT_EQUAL(get<ReadRouteRequest>(requests[3]).from, "Biryulyovo Zapadnoye");
+	ASSERT_EQUAL(get<ReadRouteRequest>(requests[3]).to, "Universam");
+	ASSERT_EQUAL(requests[3].index(), static_cast<size_t>(RequestType::READ_ROUTE));
   }
 }
 
+
+void TestReadBaseRequests() {
+  JsonParser jp;
+  {
+	// The streaming reader sees the same requests as the DOM path.
+	ifstream input("input.json");
+	const string text{istreambuf_iterator<char>(input), istreambuf_iterator<char>()};
+	const BaseRequests read = jp.ReadBaseRequests(jp.SplitInput(text).base_requests);
+	const Json::CompactDocument doc = Json::LoadCompact(text);
+	const BaseRequests expected = jp.ParseBaseRequests(doc);
+	ASSERT_EQUAL(read.stops.size(), expected.stops.size());
+	for(size_t idx = 0; idx < read.stops.size(); ++idx) {
+	  const ModifyStopRequest& stop = read.stops[idx];
+	  ASSERT_EQUAL(stop.stop_name, expected.stops[idx].stop_name);
+	  ASSERT_EQUAL(stop.latitude, expected.stops[idx].latitude);
+	  ASSERT_EQUAL(stop.longitude, expected.stops[idx].longitude);
+	  ASSERT_EQUAL(stop.distances.size(), expected.stops[idx].distances.size());
+	  for(size_t i = 0; i < stop.distances.size(); ++i) {
+		ASSERT_EQUAL(stop.distances[i].stop_name, expected.stops[idx].distances[i].stop_name);
+		ASSERT_EQUAL(stop.distances[i].distance, expected.stops[idx].distances[i].distance);
+	  }
+	}
+	ASSERT_EQUAL(read.buses.size(), expected.buses.size());
+	for(size_t idx = 0; idx < read.buses.size(); ++idx) {
+	  ASSERT_EQUAL(read.buses[idx].bus_name, expected.buses[idx].bus_name);
+	  ASSERT_EQUAL(read.buses[idx].stops, expected.buses[idx].stops);
+	  ASSERT_EQUAL(read.buses[idx].cycle, expected.buses[idx].cycle);
+	}
+  }
+  {
+	// Any field order; unknown fields and types are skipped, the first of
+	// duplicate keys wins and distances come out sorted by stop name.
+	const BaseRequests read = jp.ReadBaseRequests(
+		"[{\"stops\": [\"A\", \"B \\\"2\\\"\"], \"name\": \"1\", \"is_roundtrip\": false,"
+		"  \"type\": \"Bus\", \"extra\": {\"x\": [1, 2]}},"
+		" {\"type\": \"Tram\", \"name\": \"T\"},"
+		" {\"name\": \"A\", \"type\": \"Stop\", \"latitude\": 90, \"longitude\": -45.5,"
+		"  \"road_distances\": {\"C\": 300, \"B\": 200, \"C\": 100}, \"name\": \"Z\"}]");
+	ASSERT_EQUAL(read.buses.size(), 1u);
+	ASSERT_EQUAL(read.buses[0].bus_name, "1");
+	ASSERT_EQUAL(read.buses[0].stops, (vector<string>{"A", "B \"2\""}));
+	ASSERT_EQUAL(read.buses[0].cycle, false);
+	ASSERT_EQUAL(read.stops.size(), 1u);
+	ASSERT_EQUAL(read.stops[0].stop_name, "A");
+	ASSERT_EQUAL(read.stops[0].latitude, 3.1415926535 * 90 / 180);
+	ASSERT_EQUAL(read.stops[0].longitude, 3.1415926535 * -45.5 / 180);
+	ASSERT_EQUAL(read.stops[0].distances.size(), 2u);
+	ASSERT_EQUAL(read.stops[0].distances[0].stop_name, "B");
+	ASSERT_EQUAL(read.stops[0].distances[1].stop_name, "C");
+	ASSERT_EQUAL(read.stops[0].distances[1].distance, 300);
+  }
+  ASSERT(jp.ReadBaseRequests("[]").stops.empty());
+  bool failed = false;
+  try {
+	jp.ReadBaseRequests("[{\"type\": \"Stop\", \"name\": \"A\"}]");
+  } catch (out_of_range&) {
+	failed = true;
+  }
+  ASSERT(failed);
+}
+
+void TestJsonLoad() {
+  const Json::Document doc = Json::Load(string_view(
+	  "{\"a\": [1, -2, 3.5, -0.25, true, false, [], {}],\n"
+	  " \"b\" : {\"say \\\"hi\\\"\": \"line\\nbreak\"}, \"c\":\"\"}"));
+  const auto& root = doc.GetRoot().AsMap();
+  const auto& a = root.at("a").AsArray();
+  ASSERT_EQUAL(a.size(), 8u);
+  ASSERT_EQUAL(a[0].AsInt(), 1);
+  ASSERT_EQUAL(a[1].AsInt(), -2);
+  ASSERT_EQUAL(a[2].AsDouble(), 3.5);
+  ASSERT_EQUAL(a[3].AsDouble(), -0.25);
+  ASSERT_EQUAL(a[4].AsBool(), true);
+  ASSERT_EQUAL(a[5].AsBool(), false);
+  ASSERT(a[6].AsArray().empty());
+  ASSERT(a[7].AsMap().empty());
+  ASSERT_EQUAL(root.at("b").AsMap().at("say \"hi\"").AsString(), "line\nbreak");
+  ASSERT_EQUAL(root.at("c").AsString(), "");
+
+  bool failed = false;
+  try {
+	Json::Load(string_view("[1, 2"));
+  } catch (invalid_argument&) {
+	failed = true;
+  }
+  ASSERT(failed);
+}
+
+void TestCompactJson() {
+  ASSERT_EQUAL(sizeof(Json::CompactNode), 16u);
+  istringstream input(
+	  "{\"b\": [1, -2.5, true, [], {}], \"a\": {\"say \\\"hi\\\"\": \"x\\ny\"},"
+	  " \"c\": \"plain\", \"a\": 5}");
+  const Json::CompactDocument doc = Json::LoadCompact(input);
+  const auto root = doc.GetRoot().AsMap();
+  ASSERT_EQUAL(root.size(), 3u);
+  vector<string> keys;
+  for(const auto& [key, value] : root) {
+	keys.emplace_back(key);
+  }
+  ASSERT_EQUAL(keys, (vector<string>{"a", "b", "c"}));
+  // The first of duplicate keys wins, as in Node's map.
+  ASSERT(root.at("a").IsMap());
+  ASSERT_EQUAL(root.at("a").AsMap().at("say \"hi\"").AsString(), "x\ny");
+  ASSERT_EQUAL(root.at("c").AsString(), "plain");
+  ASSERT_EQUAL(root.count("d"), 0u);
+
+  const auto b = root.at("b").AsArray();
+  ASSERT_EQUAL(b.size(), 5u);
+  ASSERT_EQUAL(b[0].AsInt(), 1);
+  ASSERT_EQUAL(b[0].AsDouble(), 1.0);
+  ASSERT_EQUAL(b[1].AsDouble(), -2.5);
+  ASSERT_EQUAL(b[2].AsBool(), true);
+  ASSERT(b[3].AsArray().empty());
+  ASSERT(b[4].AsMap().empty());
+
+  bool failed = false;
+  try {
+	root.at("d");
+  } catch (out_of_range&) {
+	failed = true;
+  }
+  ASSERT(failed);
+  failed = false;
+  try {
+	root.at("c").AsInt();
+  } catch (bad_variant_access&) {
+	failed = true;
+  }
+  ASSERT(failed);
+  ASSERT(Json::CompactDocument().GetRoot().AsArray().empty());
+
+  // A reset arena hands out its blocks again, starting with empty containers.
+  Json::Arena arena;
+  for(int round = 0; round < 2; ++round) {
+	arena.Reset();
+	Json::Parser parser(string_view("[[], {\"k\": [7]}]"));
+	const auto items = parser.ParseCompactNode(arena).AsArray();
+	ASSERT_EQUAL(items.size(), 2u);
+	ASSERT(items[0].AsArray().empty());
+	ASSERT_EQUAL(items[1].AsMap().at("k").AsArray()[0].AsInt(), 7);
+  }
+}
+
+void TestRoutingSettings() {
+  JsonParser jp;
+  auto parse = [&jp](string_view settings) {
+	return jp.GetRoutingSettings(Json::LoadCompact(settings).GetRoot());
+  };
+  ASSERT_EQUAL(parse("{\"bus_wait_time\": 6, \"bus_velocity\": 40, \"route_cache_bytes\": 0}")
+	  .route_cache_bytes, 0u);
+  ASSERT_EQUAL(parse("{\"bus_wait_time\": 6, \"bus_velocity\": 40, \"route_cache_bytes\": 4294967296}")
+	  .route_cache_bytes, 4294967296u);
+  for(const string_view value: {"-1", "1.5", "1e30", "\"1\""}) {
+	bool failed = false;
+	try {
+	  parse("{\"bus_wait_time\": 6, \"bus_velocity\": 40, \"route_cache_bytes\": " + string(value) + "}");
+	} catch (invalid_argument&) {
+	  failed = true;
+	}
+	ASSERT(failed);
+  }
+  ASSERT_EQUAL(parse("{\"bus_wait_time\": 6, \"bus_velocity\": 40, \"thread_count\": 0}")
+	  .thread_count, 0u);
+  bool failed = false;
+  try {
+	parse("{\"bus_wait_time\": 6, \"bus_velocity\": 40, \"thread_count\": -1}");
+  } catch (invalid_argument&) {
+	failed = true;
+  }
+  ASSERT(failed);
+}
+
+void TestJsonWriter() {
+  using Json::Node;
+  map<string, Node> object;
+  object["list"] = Node(vector<Node>{Node(1), Node(2.5), Node(1.0 / 3), Node(true)});
+  object["empty"] = Node(vector<Node>{});
+  object["name"] = Node("x"s);
+  const Node root(object);
+
+  ostringstream os;
+  {
+	Json::Writer writer(os, 4);
+	writer.Write(root);
+  }
+  ASSERT_EQUAL(os.str(), "{\n\"empty\": [\n],\n\"list\": [\n1,\n2.5,\n0.333333,\ntrue\n],\n\"name\": \"x\"\n}");
+  ASSERT_EQUAL(root.FromJsonToString(), os.str());
+}
+
+void TestMetrics() {
+  Metrics::Registry registry(true);
+  for(int i = 0; i < 2; ++i) {
+	Metrics::ScopedTimer timer(registry, "phase");
+  }
+  registry.SetCounter("table_bytes", 1);
+  registry.SetCounter("table_bytes", 5000000000);
+  ostringstream os;
+  registry.WriteReport(os);
+  const Json::Document doc = Json::Load(os.str());
+  const auto& root = doc.GetRoot().AsMap();
+  const auto& phase = root.at("phases").AsMap().at("phase").AsMap();
+  ASSERT_EQUAL(phase.at("calls").AsInt(), 2);
+  ASSERT(phase.at("total_ms").AsDouble() >= 0);
+  ASSERT_EQUAL(root.at("counters").AsMap().at("table_bytes").AsDouble(), 5e9);
+
+  Metrics::Histogram& histogram = *registry.GetHistogram("request");
+  ASSERT(registry.GetHistogram("request") == &histogram);
+  for(int us = 1000; us >= 1; --us) {
+	histogram.Record(chrono::microseconds(us));
+  }
+  ASSERT_EQUAL(histogram.GetCount(), 1000u);
+  ASSERT(histogram.GetMax() == chrono::microseconds(1000));
+  for(const double quantile: {0.5, 0.9, 0.99, 0.999}) {
+	const double exact = quantile * 1000;
+	const double reported = chrono::duration<double, micro>(histogram.GetPercentile(quantile)).count();
+	ASSERT(reported >= exact && reported <= exact * 1.04);
+  }
+  ASSERT(histogram.GetPercentile(1) == histogram.GetMax());
+  ostringstream latency_report;
+  registry.WriteReport(latency_report);
+  const Json::Document latency_doc = Json::Load(latency_report.str());
+  const auto& latency = latency_doc.GetRoot().AsMap().at("latencies").AsMap().at("request").AsMap();
+  ASSERT_EQUAL(latency.at("count").AsInt(), 1000);
+  ASSERT_EQUAL(latency.at("max_us").AsDouble(), 1000);
+  registry.Clear();
+  ASSERT_EQUAL(histogram.GetCount(), 0u);
+  ASSERT(histogram.GetPercentile(0.5) == Metrics::Clock::duration::zero());
+
+  Metrics::Registry disabled(false);
+  ASSERT(disabled.GetHistogram("request") == nullptr);
+  {
+	Metrics::ScopedTimer timer(disabled, "phase");
+  }
+  ostringstream empty;
+  disabled.WriteReport(empty);
+  ASSERT(Json::Load(empty.str()).GetRoot().AsMap().at("phases").AsMap().empty());
+}
+
+void TestTrace() {
+  // Only WriteTrace is used, the path just enables the recorder.
+  Trace::Recorder recorder("unused.json");
+  {
+	Trace::Span outer(recorder, "ReadRouteRequest", "stat_request");
+	outer.Arg("id", 7).Arg("from", "A");
+	Trace::Span inner(recorder, "router_build", "phase");
+  }
+  ostringstream os;
+  recorder.WriteTrace(os);
+  const Json::Document doc = Json::Load(os.str());
+  const auto& events = doc.GetRoot().AsMap().at("traceEvents").AsArray();
+  ASSERT_EQUAL(events.size(), 2u);
+  // The inner span ends first.
+  const auto& inner = events[0].AsMap();
+  const auto& outer = events[1].AsMap();
+  ASSERT_EQUAL(inner.at("name").AsString(), "router_build");
+  ASSERT_EQUAL(outer.at("ph").AsString(), "X");
+  ASSERT_EQUAL(outer.at("cat").AsString(), "stat_request");
+  ASSERT_EQUAL(outer.at("args").AsMap().at("id").AsInt(), 7);
+  ASSERT_EQUAL(outer.at("args").AsMap().at("from").AsString(), "A");
+  ASSERT(inner.count("args") == 0);
+  ASSERT_EQUAL(inner.at("tid").AsInt(), outer.at("tid").AsInt());
+  ASSERT(inner.at("ts").AsDouble() >= outer.at("ts").AsDouble());
+  ASSERT(inner.at("ts").AsDouble() + inner.at("dur").AsDouble() <=
+		  outer.at("ts").AsDouble() + outer.at("dur").AsDouble());
+
+  Trace::Recorder disabled;
+  {
+	Trace::Span span(disabled, "ReadBusRequest", "stat_request");
+	span.Arg("id", 1);
+  }
+  ostringstream empty;
+  disabled.WriteTrace(empty);
+  ASSERT(Json::Load(empty.str()).GetRoot().AsMap().at("traceEvents").AsArray().empty());
+}
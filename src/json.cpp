@@ -1,5 +1,18 @@
 #include "json.h"
 
+#include <algorithm>
+#include <array>
+#include <cctype>
+#include <charconv>
+#include <cstring>
+#include <stdexcept>
+#include <iterator>
+
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
 using namespace std;
 
 namespace Json {
@@ -11,93 +24,606 @@ namespace Json {
     return root;
   }
 
-  Node LoadNode(istream& input);
+  void* Arena::Allocate(size_t bytes, size_t alignment) {
+    if (bytes == 0) {
+      // Empty arrays and objects need no storage.
+      return nullptr;
+    }
+    allocated_bytes += bytes;
+    if (bytes > BLOCK_SIZE / 4) {
+      // Large arrays get a block of their own so the current block is not wasted.
+      large_blocks.push_back(make_unique<char[]>(bytes));
+      return large_blocks.back().get();
+    }
+    block_used = (block_used + alignment - 1) / alignment * alignment;
+    if (block_used + bytes > BLOCK_SIZE) {
+      if (current_block + 1 < blocks.size()) {
+        ++current_block;
+      } else {
+        blocks.push_back(make_unique<char[]>(BLOCK_SIZE));
+        current_block = blocks.size() - 1;
+      }
+      block_used = 0;
+    }
+    void* data = blocks[current_block].get() + block_used;
+    block_used += bytes;
+    return data;
+  }
 
-  Node LoadArray(istream& input) {
-    vector<Node> result;
+  string_view Arena::StoreString(string_view str) {
+    if (str.empty()) {
+      return {};
+    }
+    char* data = AllocateArray<char>(str.size());
+    memcpy(data, str.data(), str.size());
+    return {data, str.size()};
+  }
+
+  void Arena::Reset() {
+    large_blocks.clear();
+    current_block = 0;
+    block_used = blocks.empty() ? BLOCK_SIZE : 0;
+    allocated_bytes = 0;
+  }
+
+  size_t Arena::GetAllocatedBytes() const {
+    return allocated_bytes;
+  }
+
+  CompactNode CompactNode::MakeArray(const CompactNode* items, uint32_t size) {
+    CompactNode node;
+    node.items = items;
+    node.size = size;
+    return node;
+  }
+
+  CompactNode CompactNode::MakeObject(const CompactMember* members, uint32_t size) {
+    CompactNode node;
+    node.type = Type::OBJECT;
+    node.members = members;
+    node.size = size;
+    return node;
+  }
+
+  CompactNode CompactNode::MakeString(string_view str) {
+    CompactNode node;
+    node.type = Type::STRING;
+    node.chars = str.data();
+    node.size = str.size();
+    return node;
+  }
+
+  CompactNode CompactNode::MakeInt(int value) {
+    CompactNode node;
+    node.type = Type::INT;
+    node.int_value = value;
+    return node;
+  }
+
+  CompactNode CompactNode::MakeDouble(double value) {
+    CompactNode node;
+    node.type = Type::DOUBLE;
+    node.double_value = value;
+    return node;
+  }
+
+  CompactNode CompactNode::MakeBool(bool value) {
+    CompactNode node;
+    node.type = Type::BOOL;
+    node.bool_value = value;
+    return node;
+  }
+
+  const CompactMember* CompactObject::find(string_view key) const {
+    const CompactMember* member = lower_bound(begin(), end(), key,
+        [](const CompactMember& lhs, string_view rhs) { return lhs.key < rhs; });
+    return member != end() && member->key == key ? member : end();
+  }
+
+  CompactDocument::CompactDocument(unique_ptr<Arena> arena, CompactNode root)
+      : arena(move(arena)), root(root) {
+  }
+
+  const CompactNode& CompactDocument::GetRoot() const {
+    return root;
+  }
+
+  size_t CompactDocument::GetArenaBytes() const {
+    return arena ? arena->GetAllocatedBytes() : 0;
+  }
+
+  InputBuffer InputBuffer::FromFile(const string& path) {
+    const int fd = open(path.c_str(), O_RDONLY);
+    if (fd < 0) {
+      throw runtime_error("cannot open " + path);
+    }
+    InputBuffer buffer = FromFileDescriptor(fd);
+    close(fd);
+    return buffer;
+  }
 
-    for (char c; input >> c && c != ']'; ) {
-      if (c != ',') {
-        input.putback(c);
+  InputBuffer InputBuffer::FromFileDescriptor(int fd) {
+    InputBuffer buffer;
+    struct stat file_stat;
+    if (fstat(fd, &file_stat) == 0 && S_ISREG(file_stat.st_mode) && file_stat.st_size > 0) {
+      void* data = mmap(nullptr, file_stat.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+      if (data != MAP_FAILED) {
+        madvise(data, file_stat.st_size, MADV_SEQUENTIAL);
+        buffer.mapped_data = data;
+        buffer.mapped_size = file_stat.st_size;
+        return buffer;
       }
-      result.push_back(LoadNode(input));
     }
+    char chunk[1 << 16];
+    for (ssize_t read_size; (read_size = read(fd, chunk, sizeof(chunk))) > 0; ) {
+      buffer.content.append(chunk, read_size);
+    }
+    return buffer;
+  }
 
-    return Node(move(result));
+  InputBuffer InputBuffer::FromStream(istream& input) {
+    InputBuffer buffer;
+    buffer.content.assign(istreambuf_iterator<char>(input), istreambuf_iterator<char>());
+    return buffer;
   }
 
-  variant<int, double> ReadNumber(istream& input) {
-  	int integer;
-  	double rational;
-  	input >> integer;
-  	if(input.peek() == '.'){
-  	  input >> rational;
-  	  if(integer < 0) {
-  		return - rational + integer;
-  	  }
-  	  return rational + integer;
-  	} else {
-  	  return integer;
-  	}
+  InputBuffer::InputBuffer(InputBuffer&& other)
+      : mapped_data(other.mapped_data),
+        mapped_size(other.mapped_size),
+        content(move(other.content)) {
+    other.mapped_data = nullptr;
+    other.mapped_size = 0;
   }
 
-  Node LoadNumber(istream& input) {
-    auto result = ReadNumber(input);
-    if(holds_alternative<int>(result)) {
-      return Node(get<int>(result));
+  InputBuffer& InputBuffer::operator=(InputBuffer&& other) {
+    if (this != &other) {
+      Unmap();
+      mapped_data = other.mapped_data;
+      mapped_size = other.mapped_size;
+      content = move(other.content);
+      other.mapped_data = nullptr;
+      other.mapped_size = 0;
     }
-    return Node(get<double>(result));
+    return *this;
   }
 
-  Node LoadBool(istream& input) {
-    bool result;
-    input >> boolalpha >> result;
-    return Node(result);
+  InputBuffer::~InputBuffer() {
+    Unmap();
   }
 
-  Node LoadString(istream& input) {
-    string line;
-    getline(input, line, '"');
-    return Node(move(line));
+  void InputBuffer::Unmap() {
+    if (mapped_data) {
+      munmap(mapped_data, mapped_size);
+      mapped_data = nullptr;
+      mapped_size = 0;
+    }
   }
 
-  Node LoadDict(istream& input) {
-    map<string, Node> result;
+  string_view InputBuffer::GetText() const {
+    if (mapped_data) {
+      return {static_cast<const char*>(mapped_data), mapped_size};
+    }
+    return content;
+  }
 
-    for (char c; input >> c && c != '}'; ) {
-      if (c == ',') {
-        input >> c;
+  Parser::Parser(string_view text) : text(text) {
+  }
+
+  void Parser::Fail(const string& message) const {
+    throw invalid_argument("JSON: " + message + " at offset " + to_string(pos));
+  }
+
+  bool Parser::AtEnd() {
+    SkipSpaces();
+    return pos == text.size();
+  }
+
+  size_t Parser::GetPosition() const {
+    return pos;
+  }
+
+  string_view Parser::ParseString(string& scratch) {
+    Expect('"');
+    const size_t begin = pos;
+    const size_t end = text.find_first_of("\"\\", begin);
+    if (end == string_view::npos) {
+      Fail("unterminated string");
+    }
+    pos = end + 1;
+    if (text[end] == '"') {
+      return text.substr(begin, end - begin);
+    }
+
+    scratch.assign(text.substr(begin, end - begin));
+    for (pos = end; pos < text.size() && text[pos] != '"'; ++pos) {
+      if (text[pos] != '\\') {
+        scratch.push_back(text[pos]);
+        continue;
+      }
+      if (++pos == text.size()) {
+        break;
       }
+      switch (text[pos]) {
+        case 'n': scratch.push_back('\n'); break;
+        case 't': scratch.push_back('\t'); break;
+        case 'r': scratch.push_back('\r'); break;
+        case 'b': scratch.push_back('\b'); break;
+        case 'f': scratch.push_back('\f'); break;
+        default: scratch.push_back(text[pos]); break;
+      }
+    }
+    if (pos == text.size()) {
+      Fail("unterminated string");
+    }
+    ++pos;
+    return scratch;
+  }
 
-      string key = LoadString(input).AsString();
-      input >> c;
-      result.emplace(move(key), LoadNode(input));
+  Node Parser::ParseArray() {
+    Expect('[');
+    vector<Node> result;
+    if (TryConsume(']')) {
+      return Node(move(result));
     }
+    do {
+      result.push_back(ParseNode());
+    } while (TryConsume(','));
+    Expect(']');
+    return Node(move(result));
+  }
 
+  Node Parser::ParseDict() {
+    Expect('{');
+    map<string, Node> result;
+    if (TryConsume('}')) {
+      return Node(move(result));
+    }
+    string scratch;
+    do {
+      string key(ParseString(scratch));
+      Expect(':');
+      result.emplace(move(key), ParseNode());
+    } while (TryConsume(','));
+    Expect('}');
     return Node(move(result));
   }
 
-  Node LoadNode(istream& input) {
-    char c;
-    input >> c;
+  Node Parser::ParseNumber() {
+    SkipSpaces();
+    const size_t begin = pos;
+    bool is_integer = true;
+    for (; pos < text.size(); ++pos) {
+      const char c = text[pos];
+      if (c == '.' || c == 'e' || c == 'E') {
+        is_integer = false;
+      } else if (!isdigit(static_cast<unsigned char>(c)) && c != '-' && c != '+') {
+        break;
+      }
+    }
+    const char* first = text.data() + begin;
+    const char* last = text.data() + pos;
+    if (is_integer) {
+      int integer;
+      if (auto [ptr, ec] = from_chars(first, last, integer); ec == errc() && ptr == last) {
+        return Node(integer);
+      }
+    }
+    double rational;
+    if (auto [ptr, ec] = from_chars(first, last, rational); ec != errc() || ptr != last) {
+      pos = begin;
+      Fail("bad number");
+    }
+    return Node(rational);
+  }
 
+  Node Parser::ParseBool() {
+    SkipSpaces();
+    if (text.substr(pos, 4) == "true") {
+      pos += 4;
+      return Node(true);
+    }
+    if (text.substr(pos, 5) == "false") {
+      pos += 5;
+      return Node(false);
+    }
+    Fail("unexpected character");
+  }
+
+  Node Parser::ParseNode() {
+    const char c = Peek();
     if (c == '[') {
-      return LoadArray(input);
+      return ParseArray();
     } else if (c == '{') {
-      return LoadDict(input);
+      return ParseDict();
     } else if (c == '"') {
-      return LoadString(input);
-    } else if(c == '-' || isdigit(c)){
-      input.putback(c);
-      return LoadNumber(input);
+      string scratch;
+      return Node(string(ParseString(scratch)));
+    } else if (c == '-' || isdigit(static_cast<unsigned char>(c))) {
+      return ParseNumber();
     } else {
-      input.putback(c);
-      return LoadBool(input);
+      return ParseBool();
+    }
+  }
+
+  string_view Parser::ParseCompactString(Arena& arena) {
+    const string_view str = ParseString(string_scratch);
+    // Unescaped strings are views into the text and need no copy.
+    return str.data() == string_scratch.data() ? arena.StoreString(str) : str;
+  }
+
+  CompactNode Parser::ParseCompactNode(Arena& arena) {
+    const char c = Peek();
+    if (c == '[') {
+      ++pos;
+      const size_t stack_begin = node_stack.size();
+      if (!TryConsume(']')) {
+        do {
+          CompactNode item = ParseCompactNode(arena);
+          node_stack.push_back(item);
+        } while (TryConsume(','));
+        Expect(']');
+      }
+      const size_t count = node_stack.size() - stack_begin;
+      CompactNode* items = arena.AllocateArray<CompactNode>(count);
+      copy(node_stack.begin() + stack_begin, node_stack.end(), items);
+      node_stack.resize(stack_begin);
+      return CompactNode::MakeArray(items, count);
+    } else if (c == '{') {
+      ++pos;
+      const size_t stack_begin = member_stack.size();
+      if (!TryConsume('}')) {
+        do {
+          const string_view key = ParseCompactString(arena);
+          Expect(':');
+          CompactNode value = ParseCompactNode(arena);
+          member_stack.push_back({key, value});
+        } while (TryConsume(','));
+        Expect('}');
+      }
+      // Like std::map::emplace, the first of duplicate keys wins.
+      const auto members_begin = member_stack.begin() + stack_begin;
+      auto key_less = [](const CompactMember& lhs, const CompactMember& rhs) { return lhs.key < rhs.key; };
+      auto key_equal = [](const CompactMember& lhs, const CompactMember& rhs) { return lhs.key == rhs.key; };
+      if (!is_sorted(members_begin, member_stack.end(), key_less)) {
+        stable_sort(members_begin, member_stack.end(), key_less);
+      }
+      const auto members_end = unique(members_begin, member_stack.end(), key_equal);
+      const size_t count = members_end - members_begin;
+      CompactMember* members = arena.AllocateArray<CompactMember>(count);
+      copy(members_begin, members_end, members);
+      member_stack.resize(stack_begin);
+      return CompactNode::MakeObject(members, count);
+    } else if (c == '"') {
+      return CompactNode::MakeString(ParseCompactString(arena));
+    } else if (c == '-' || isdigit(static_cast<unsigned char>(c))) {
+      const Node number = ParseNumber();
+      return number.IsInt() ? CompactNode::MakeInt(number.AsInt()) : CompactNode::MakeDouble(number.AsDouble());
+    } else {
+      return CompactNode::MakeBool(ParseBool().AsBool());
+    }
+  }
+
+  CompactDocument Parser::ParseCompactDocument() {
+    auto arena = make_unique<Arena>();
+    const CompactNode root = ParseCompactNode(*arena);
+    return CompactDocument(move(arena), root);
+  }
+
+  void Parser::SkipString() {
+    Expect('"');
+    // A quote ends the string unless an odd number of backslashes escapes it.
+    while (true) {
+      const void* quote = memchr(text.data() + pos, '"', text.size() - pos);
+      if (quote == nullptr) {
+        pos = text.size();
+        Fail("unterminated string");
+      }
+      const size_t quote_pos = static_cast<const char*>(quote) - text.data();
+      size_t backslashes = 0;
+      while (backslashes < quote_pos - pos && text[quote_pos - backslashes - 1] == '\\') {
+        ++backslashes;
+      }
+      pos = quote_pos + 1;
+      if (backslashes % 2 == 0) {
+        return;
+      }
+    }
+  }
+
+  void Parser::SkipValue() {
+    const char c = Peek();
+    if (c == '"') {
+      SkipString();
+    } else if (c == '[' || c == '{') {
+      // Only brackets and strings matter, so the scan jumps from one to the
+      // next. Strings are skipped whole, so brackets inside them are not counted.
+      static constexpr auto IS_STRUCTURAL = [] {
+        array<bool, 256> table{};
+        for (const char structural : {'"', '[', ']', '{', '}'}) {
+          table[static_cast<unsigned char>(structural)] = true;
+        }
+        return table;
+      }();
+      size_t depth = 0;
+      do {
+        while (pos < text.size() && !IS_STRUCTURAL[static_cast<unsigned char>(text[pos])]) {
+          ++pos;
+        }
+        if (pos == text.size()) {
+          Fail("unexpected end of input");
+        }
+        const char next = text[pos];
+        if (next == '"') {
+          SkipString();
+          continue;
+        }
+        if (next == '[' || next == '{') {
+          ++depth;
+        } else if (next == ']' || next == '}') {
+          --depth;
+        }
+        ++pos;
+      } while (depth > 0);
+    } else {
+      ParseNode();
+    }
+  }
+
+  string Node::FromJsonToString() const {
+    ostringstream os;
+    {
+      Writer writer(os);
+      writer.Write(*this);
+    }
+    return os.str();
+  }
+
+  Writer::Writer(ostream& output, size_t flush_threshold)
+      : output(output),
+        flush_threshold(flush_threshold),
+        precision(static_cast<int>(output.precision())) {
+    buffer.reserve(flush_threshold + 256);
+  }
+
+  Writer::~Writer() {
+    Flush();
+  }
+
+  void Writer::Flush() {
+    output.write(buffer.data(), buffer.size());
+    buffer.clear();
+  }
+
+  void Writer::FlushIfFull() {
+    if (buffer.size() >= flush_threshold) {
+      Flush();
     }
   }
 
+  void Writer::BeginItem() {
+    if (after_key) {
+      after_key = false;
+      return;
+    }
+    if (!scope_has_items.empty()) {
+      if (scope_has_items.back()) {
+        buffer += ",\n";
+      }
+      scope_has_items.back() = true;
+    }
+  }
+
+  void Writer::EndScope(char bracket) {
+    if (scope_has_items.back()) {
+      buffer += '\n';
+    }
+    buffer += bracket;
+    scope_has_items.pop_back();
+    FlushIfFull();
+  }
+
+  void Writer::BeginArray() {
+    BeginItem();
+    buffer += "[\n";
+    scope_has_items.push_back(false);
+  }
+
+  void Writer::EndArray() {
+    EndScope(']');
+  }
+
+  void Writer::BeginObject() {
+    BeginItem();
+    buffer += "{\n";
+    scope_has_items.push_back(false);
+  }
+
+  void Writer::Key(string_view key) {
+    BeginItem();
+    buffer += '"';
+    buffer += key;
+    buffer += "\": ";
+    after_key = true;
+  }
+
+  void Writer::EndObject() {
+    EndScope('}');
+  }
+
+  void Writer::Value(int value) {
+    BeginItem();
+    char chars[16];
+    buffer.append(chars, to_chars(begin(chars), end(chars), value).ptr);
+    FlushIfFull();
+  }
+
+  void Writer::Value(double value) {
+    BeginItem();
+    char chars[64];
+    buffer.append(chars, to_chars(begin(chars), end(chars), value, chars_format::general, precision).ptr);
+    FlushIfFull();
+  }
+
+  void Writer::Value(string_view value) {
+    BeginItem();
+    buffer += '"';
+    buffer += value;
+    buffer += '"';
+    FlushIfFull();
+  }
+
+  void Writer::Value(bool value) {
+    BeginItem();
+    buffer += value ? "true" : "false";
+    FlushIfFull();
+  }
+
+  void Writer::Write(const Node& node) {
+    if (node.IsArray()) {
+      BeginArray();
+      for (const Node& item : node.AsArray()) {
+        Write(item);
+      }
+      EndArray();
+    } else if (node.IsMap()) {
+      BeginObject();
+      for (const auto& [key, value] : node.AsMap()) {
+        Key(key);
+        Write(value);
+      }
+      EndObject();
+    } else if (node.IsString()) {
+      Value(string_view(node.AsString()));
+    } else if (node.IsInt()) {
+      Value(node.AsInt());
+    } else if (node.IsDouble()) {
+      Value(node.AsDouble());
+    } else if (node.IsBool()) {
+      Value(node.AsBool());
+    }
+  }
+
+  Document Load(string_view text) {
+    Parser parser(text);
+    return Document{parser.ParseNode()};
+  }
+
   Document Load(istream& input) {
-    return Document{LoadNode(input)};
+    const InputBuffer buffer = InputBuffer::FromStream(input);
+    return Load(buffer.GetText());
+  }
+
+  CompactDocument LoadCompact(string_view text) {
+    Parser parser(text);
+    return parser.ParseCompactDocument();
+  }
+
+  CompactDocument LoadCompact(istream& input) {
+    const InputBuffer buffer = InputBuffer::FromStream(input);
+    auto arena = make_unique<Arena>();
+    Parser parser(arena->StoreString(buffer.GetText()));
+    const CompactNode root = parser.ParseCompactNode(*arena);
+    return CompactDocument(move(arena), root);
   }
 
 }
@@ -2,7 +2,10 @@
 #include "Requests.h"
 #include "test_runner.h"
 #include "RouteManager.h"
+#include "thread_pool.h"
+#include "metrics.h"
 #include <fstream>
+#include <unistd.h>
 
 using namespace std;
 
@@ -10,51 +13,139 @@ using namespace std;
 void TestAll() {
   TestRunner tr;
   RUN_TEST(tr, TestModifyAndReadRequest);
+  RUN_TEST(tr, TestReadBaseRequests);
+  RUN_TEST(tr, TestJsonLoad);
+  RUN_TEST(tr, TestJsonWriter);
+  RUN_TEST(tr, TestCompactJson);
+  RUN_TEST(tr, TestRoutingSettings);
   RUN_TEST(tr, TestComputeDistance);
   RUN_TEST(tr, TestBusStats);
   RUN_TEST(tr, TestStopStats);
+  RUN_TEST(tr, TestDijkstraRouter);
+  RUN_TEST(tr, TestTransitGraphModel);
+  RUN_TEST(tr, TestBlockedFloydWarshall);
+  RUN_TEST(tr, TestMinPlusKernels);
+  RUN_TEST(tr, TestEdgeIndex);
+  RUN_TEST(tr, TestStringPool);
+  RUN_TEST(tr, TestSnapshot);
+  RUN_TEST(tr, TestRouteCache);
+  RUN_TEST(tr, TestRoadDistanceOnlyStop);
+  RUN_TEST(tr, TestMetrics);
+  RUN_TEST(tr, TestTrace);
 }
 
-void ModifyProcessing(const Visitor& visitor, const vector<RequestHolder>& requests) {
-  for(const RequestHolder& r: requests) {
-    if(r->type == Request::Type::MODIFY_STOP) {
-	  r->Accept(visitor);
-	}
+void ModifyProcessing(const Visitor& visitor, const BaseRequests& requests) {
+  Metrics::ScopedTimer timer("modify_processing");
+  for(const ModifyStopRequest& r: requests.stops) {
+	visitor.Visit(r);
   }
-  for(const RequestHolder& r: requests) {
-	if(r->type == Request::Type::MODIFY_BUS) {
-	  r->Accept(visitor);
-	}
+  for(const ModifyBusRequest& r: requests.buses) {
+	visitor.Visit(r);
   }
 }
 
-Json::Document ReadProcessing(const Visitor& visitor, const vector<RequestHolder>& requests) {
+// Read requests do not modify the network, so they are answered concurrently;
+// each response is stored at its request's index to keep the input order.
+vector<Json::Node> ReadProcessing(const Visitor& visitor, const vector<StatRequest>& requests,
+		ThreadPool& pool) {
   using namespace Json;
-  vector<Node> nodes;
-  for(const RequestHolder& r: requests) {
-	nodes.push_back(*(r->Accept(visitor)));
+  vector<Node> nodes(requests.size());
+  pool.ParallelFor(requests.size(), [&](size_t idx) {
+	nodes[idx] = visitor.Visit(requests[idx]);
+  });
+  return nodes;
+}
+
+// Parses, answers and writes stat requests one batch at a time, so memory use
+// does not grow with the number of requests.
+void StreamReadProcessing(const Visitor& visitor, StatRequestStream& stream,
+		ThreadPool& pool, Json::Writer& writer) {
+  Metrics::ScopedTimer timer("read_processing");
+  const size_t batch_size = 1024 * pool.GetThreadCount();
+  writer.BeginArray();
+  while(!stream.AtEnd()) {
+	const auto read_requests = stream.ReadBatch(batch_size);
+	for(const Json::Node& node: ReadProcessing(visitor, read_requests, pool)) {
+	  writer.Write(node);
+	}
+  }
+  writer.EndArray();
+}
+
+// Builds the network from the routing settings and base requests of the input.
+unique_ptr<RouteManager> BuildRouteManager(JsonParser& jp, JsonParser::InputSections& sections) {
+  auto rm = make_unique<RouteManager>(jp.GetRoutingSettings(sections.routing_settings.GetRoot()));
+  Visitor visitor;
+  visitor.SetRouteManager(rm.get());
+  // RouteManager copies the names it keeps, so the parsed requests are freed
+  // as soon as they have been applied.
+  BaseRequests base_requests;
+  {
+    Metrics::ScopedTimer timer("base_requests_parse");
+    base_requests = jp.ReadBaseRequests(sections.base_requests);
   }
-  return Document (Node(nodes));
+  ModifyProcessing(visitor, base_requests);
+  return rm;
 }
 
-int main() {
+// Writes the stats report and the trace if the TRANSPORT_STATS and
+// TRANSPORT_TRACE environment variables ask for them.
+void WriteReports(const RouteManager& rm) {
+  Metrics::Registry& registry = Metrics::Registry::Global();
+  if(registry.IsEnabled()) {
+    rm.RecordMetrics(registry);
+    registry.Report();
+  }
+  Trace::Recorder::Global().Save();
+}
+
+// Without arguments the whole input is processed in one run. Otherwise the work
+// is split in two: "make_base" builds the network and saves its snapshot to the
+// file named in serialization_settings, "process_requests" loads the snapshot
+// from there and only answers stat_requests.
+int main(int argc, const char* argv[]) {
   using namespace Json;
-  //ofstream out("output.json");
-  //ifstream input("input_main.json");
-  //out.precision(6);
+  const string_view mode = argc > 1 ? argv[1] : "";
+  if(!mode.empty() && mode != "make_base" && mode != "process_requests") {
+    cerr << "Usage: " << argv[0] << " [make_base|process_requests]" << endl;
+    return 1;
+  }
   TestAll();
+  // The self-tests build networks of their own, which must not be reported.
+  Metrics::Registry::Global().Clear();
+  Trace::Recorder::Global().Clear();
   cout.precision(6);
   JsonParser jp;
-  Document doc = Load(cin);
-  RouteManager rm(jp.GetRoutingSettings(doc));
+  const InputBuffer input = InputBuffer::FromFileDescriptor(STDIN_FILENO);
+  JsonParser::InputSections sections;
+  {
+    Metrics::ScopedTimer timer("json_load");
+    sections = jp.SplitInput(input.GetText());
+  }
 
-  Visitor visitor;
-  visitor.SetRouteManager(&rm);
+  unique_ptr<RouteManager> rm;
+  if(mode == "process_requests") {
+    Metrics::ScopedTimer timer("snapshot_load");
+    rm = RouteManager::Load(jp.GetSerializationFile(sections.serialization_settings.GetRoot()));
+  } else {
+    rm = BuildRouteManager(jp, sections);
+  }
+  if(mode == "make_base") {
+    {
+      Metrics::ScopedTimer timer("snapshot_write");
+      ofstream snapshot(jp.GetSerializationFile(sections.serialization_settings.GetRoot()), ios::binary);
+      rm->Serialize(snapshot);
+    }
+    WriteReports(*rm);
+    return 0;
+  }
 
-  const auto modify_requests = jp.ParseBaseRequests(doc);
-  ModifyProcessing(visitor, modify_requests);
-  const auto read_requests = jp.ParseStatRequests(doc);
-  Document output_doc = ReadProcessing(visitor, read_requests);
-  cout << output_doc.GetRoot().FromJsonToString();
+  Visitor visitor;
+  visitor.SetRouteManager(rm.get());
+  ThreadPool pool(rm->GetRoutingSettings().thread_count);
+  StatRequestStream stat_requests(sections.stat_requests);
+  Writer writer(cout);
+  StreamReadProcessing(visitor, stat_requests, pool, writer);
+  WriteReports(*rm);
   return 0;
 }
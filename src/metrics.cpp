@@ -0,0 +1,201 @@
+#include "metrics.h"
+#include "json.h"
+
+#include <algorithm>
+#include <cmath>
+#include <cstdlib>
+#include <fstream>
+#include <iostream>
+#include <sstream>
+
+using namespace std;
+
+namespace {
+
+  const pair<const char*, double> LATENCY_PERCENTILES[] = {
+      {"p50_us", 0.5}, {"p90_us", 0.9}, {"p99_us", 0.99}, {"p99.9_us", 0.999},
+  };
+
+  double ToMicroseconds(Metrics::Clock::duration duration) {
+    return chrono::duration<double, micro>(duration).count();
+  }
+
+}
+
+namespace Metrics {
+
+  void Histogram::Record(Clock::duration elapsed) {
+    const uint64_t nanoseconds = std::max<int64_t>(
+        chrono::duration_cast<chrono::nanoseconds>(elapsed).count(), 0);
+    buckets_[GetBucketIndex(nanoseconds)].fetch_add(1, memory_order_relaxed);
+    count_.fetch_add(1, memory_order_relaxed);
+    uint64_t max = max_.load(memory_order_relaxed);
+    while (nanoseconds > max && !max_.compare_exchange_weak(max, nanoseconds, memory_order_relaxed)) {
+    }
+  }
+
+  Clock::duration Histogram::GetPercentile(double quantile) const {
+    const uint64_t count = GetCount();
+    if (count == 0) {
+      return Clock::duration::zero();
+    }
+    const uint64_t rank = max<uint64_t>(ceil(quantile * count), 1);
+    uint64_t seen = 0;
+    for (size_t index = 0; index < BUCKET_COUNT; ++index) {
+      seen += buckets_[index].load(memory_order_relaxed);
+      if (seen >= rank) {
+        return min(chrono::duration_cast<Clock::duration>(
+            chrono::nanoseconds(GetBucketUpperBound(index))), GetMax());
+      }
+    }
+    return GetMax();
+  }
+
+  void Histogram::Reset() {
+    for (atomic<uint64_t>& bucket : buckets_) {
+      bucket.store(0, memory_order_relaxed);
+    }
+    count_.store(0, memory_order_relaxed);
+    max_.store(0, memory_order_relaxed);
+  }
+
+  // Values below SUB_BUCKET_COUNT get a bucket each. Above that, the values
+  // sharing their highest set bit are split by the next SUB_BUCKET_BITS bits.
+  size_t Histogram::GetBucketIndex(uint64_t nanoseconds) {
+    nanoseconds = min(nanoseconds, (uint64_t{1} << MAX_VALUE_BITS) - 1);
+    if (nanoseconds < SUB_BUCKET_COUNT) {
+      return nanoseconds;
+    }
+    unsigned highest_bit = 0;
+    while (nanoseconds >> (highest_bit + 1)) {
+      ++highest_bit;
+    }
+    const unsigned shift = highest_bit - SUB_BUCKET_BITS;
+    return (shift + 1) * SUB_BUCKET_COUNT + ((nanoseconds >> shift) - SUB_BUCKET_COUNT);
+  }
+
+  uint64_t Histogram::GetBucketUpperBound(size_t index) {
+    if (index < SUB_BUCKET_COUNT) {
+      return index;
+    }
+    const unsigned shift = index / SUB_BUCKET_COUNT - 1;
+    const uint64_t lower_bound = (index % SUB_BUCKET_COUNT + SUB_BUCKET_COUNT) << shift;
+    return lower_bound + (uint64_t{1} << shift) - 1;
+  }
+
+  Registry& Registry::Global() {
+    static Registry registry = [] {
+      const char* destination = getenv("TRANSPORT_STATS");
+      if (destination == nullptr) {
+        return Registry(false);
+      }
+      return Registry(true, destination == string_view("-") ? "" : destination);
+    }();
+    return registry;
+  }
+
+  void Registry::AddTime(string_view phase, Clock::duration elapsed) {
+    lock_guard<mutex> lock(mutex_);
+    auto it = phases_.find(phase);
+    if (it == phases_.end()) {
+      it = phases_.emplace(string(phase), PhaseTime{}).first;
+    }
+    it->second.total += elapsed;
+    ++it->second.calls;
+  }
+
+  void Registry::SetCounter(string_view counter, uint64_t value) {
+    lock_guard<mutex> lock(mutex_);
+    auto it = counters_.find(counter);
+    if (it == counters_.end()) {
+      it = counters_.emplace(string(counter), 0).first;
+    }
+    it->second = value;
+  }
+
+  Histogram* Registry::GetHistogram(string_view name) {
+    if (!enabled_) {
+      return nullptr;
+    }
+    lock_guard<mutex> lock(mutex_);
+    auto it = histograms_.find(name);
+    if (it == histograms_.end()) {
+      it = histograms_.try_emplace(string(name)).first;
+    }
+    return &it->second;
+  }
+
+  void Registry::Clear() {
+    lock_guard<mutex> lock(mutex_);
+    phases_.clear();
+    counters_.clear();
+    // Histograms are only emptied: their users keep pointers to them.
+    for (auto& [name, histogram] : histograms_) {
+      histogram.Reset();
+    }
+  }
+
+  void Registry::WriteReport(ostream& output) const {
+    lock_guard<mutex> lock(mutex_);
+    // Counters such as table sizes do not fit into an int and must not be
+    // rounded to the default six digits.
+    ostringstream report;
+    report.precision(15);
+    Json::Writer writer(report);
+    writer.BeginObject();
+    writer.Key("phases");
+    writer.BeginObject();
+    for (const auto& [phase, time] : phases_) {
+      writer.Key(phase);
+      writer.BeginObject();
+      writer.Key("calls");
+      writer.Value(static_cast<double>(time.calls));
+      writer.Key("total_ms");
+      writer.Value(chrono::duration<double, milli>(time.total).count());
+      writer.EndObject();
+    }
+    writer.EndObject();
+    writer.Key("counters");
+    writer.BeginObject();
+    for (const auto& [counter, value] : counters_) {
+      writer.Key(counter);
+      writer.Value(static_cast<double>(value));
+    }
+    writer.EndObject();
+    writer.Key("latencies");
+    writer.BeginObject();
+    for (const auto& [name, histogram] : histograms_) {
+      if (histogram.GetCount() == 0) {
+        continue;
+      }
+      writer.Key(name);
+      writer.BeginObject();
+      writer.Key("count");
+      writer.Value(static_cast<double>(histogram.GetCount()));
+      for (const auto& [key, quantile] : LATENCY_PERCENTILES) {
+        writer.Key(key);
+        writer.Value(ToMicroseconds(histogram.GetPercentile(quantile)));
+      }
+      writer.Key("max_us");
+      writer.Value(ToMicroseconds(histogram.GetMax()));
+      writer.EndObject();
+    }
+    writer.EndObject();
+    writer.EndObject();
+    writer.Flush();
+    output << report.str() << endl;
+  }
+
+  void Registry::Report() const {
+    if (!enabled_) {
+      return;
+    }
+    if (destination_.empty()) {
+      WriteReport(cerr);
+      return;
+    }
+    ofstream output(destination_);
+    WriteReport(output);
+  }
+
+}
@@ -0,0 +1,87 @@
+#include "serialization.h"
+
+#include <iterator>
+
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+using namespace std;
+
+namespace Serialization {
+
+  SnapshotData SnapshotData::FromFile(const string& path) {
+    const int fd = open(path.c_str(), O_RDONLY);
+    if (fd < 0) {
+      throw runtime_error("cannot open snapshot " + path);
+    }
+    struct stat file_stat;
+    if (fstat(fd, &file_stat) != 0 || !S_ISREG(file_stat.st_mode) || file_stat.st_size == 0) {
+      close(fd);
+      throw runtime_error("snapshot " + path + " is not a regular non-empty file");
+    }
+    void* data = mmap(nullptr, file_stat.st_size, PROT_READ, MAP_SHARED, fd, 0);
+    close(fd);
+    if (data == MAP_FAILED) {
+      throw runtime_error("cannot map snapshot " + path);
+    }
+    SnapshotData snapshot;
+    snapshot.mapped_data_ = data;
+    snapshot.mapped_size_ = file_stat.st_size;
+    return snapshot;
+  }
+
+  SnapshotData SnapshotData::FromStream(istream& input) {
+    const string content(istreambuf_iterator<char>(input), {});
+    SnapshotData snapshot;
+    snapshot.content_.resize((content.size() + ARRAY_ALIGNMENT - 1) / ARRAY_ALIGNMENT);
+    content.copy(reinterpret_cast<char*>(snapshot.content_.data()), content.size());
+    snapshot.content_size_ = content.size();
+    return snapshot;
+  }
+
+  SnapshotData::SnapshotData(SnapshotData&& other)
+      : mapped_data_(other.mapped_data_),
+        mapped_size_(other.mapped_size_),
+        content_(move(other.content_)),
+        content_size_(other.content_size_) {
+    other.mapped_data_ = nullptr;
+    other.mapped_size_ = 0;
+    other.content_size_ = 0;
+  }
+
+  SnapshotData& SnapshotData::operator=(SnapshotData&& other) {
+    if (this != &other) {
+      Release();
+      mapped_data_ = other.mapped_data_;
+      mapped_size_ = other.mapped_size_;
+      content_ = move(other.content_);
+      content_size_ = other.content_size_;
+      other.mapped_data_ = nullptr;
+      other.mapped_size_ = 0;
+      other.content_size_ = 0;
+    }
+    return *this;
+  }
+
+  SnapshotData::~SnapshotData() {
+    Release();
+  }
+
+  void SnapshotData::Release() {
+    if (mapped_data_) {
+      munmap(mapped_data_, mapped_size_);
+      mapped_data_ = nullptr;
+      mapped_size_ = 0;
+    }
+  }
+
+  string_view SnapshotData::GetData() const {
+    if (mapped_data_) {
+      return {static_cast<const char*>(mapped_data_), mapped_size_};
+    }
+    return {reinterpret_cast<const char*>(content_.data()), content_size_};
+  }
+
+}
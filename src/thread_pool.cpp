@@ -0,0 +1,80 @@
+#include "thread_pool.h"
+
+using namespace std;
+
+ThreadPool::ThreadPool(size_t thread_count) {
+  if(thread_count == 0) {
+    thread_count = max<size_t>(thread::hardware_concurrency(), 1);
+  }
+  workers_.reserve(thread_count - 1);
+  for(size_t i = 1; i < thread_count; ++i) {
+    workers_.emplace_back([this] { WorkerLoop(); });
+  }
+}
+
+ThreadPool::~ThreadPool() {
+  {
+    lock_guard<mutex> lock(mutex_);
+    stopping_ = true;
+  }
+  work_ready_.notify_all();
+  for(thread& worker: workers_) {
+    worker.join();
+  }
+}
+
+size_t ThreadPool::GetThreadCount() const {
+  return workers_.size() + 1;
+}
+
+void ThreadPool::ParallelFor(size_t task_count, const function<void(size_t)>& task) {
+  if(workers_.empty() || task_count <= 1) {
+    for(size_t index = 0; index < task_count; ++index) {
+      task(index);
+    }
+    return;
+  }
+  {
+    lock_guard<mutex> lock(mutex_);
+    current_task_ = &task;
+    current_task_count_ = task_count;
+    next_task_index_ = 0;
+    busy_workers_ = workers_.size();
+    ++generation_;
+  }
+  work_ready_.notify_all();
+
+  RunTasks();
+
+  unique_lock<mutex> lock(mutex_);
+  work_done_.wait(lock, [this] { return busy_workers_ == 0; });
+  current_task_ = nullptr;
+}
+
+void ThreadPool::RunTasks() {
+  for(size_t index = next_task_index_++; index < current_task_count_; index = next_task_index_++) {
+    (*current_task_)(index);
+  }
+}
+
+void ThreadPool::WorkerLoop() {
+  size_t seen_generation = 0;
+  while(true) {
+    {
+      unique_lock<mutex> lock(mutex_);
+      work_ready_.wait(lock, [&] { return stopping_ || generation_ != seen_generation; });
+      if(stopping_) {
+        return;
+      }
+      seen_generation = generation_;
+    }
+
+    RunTasks();
+
+    {
+      lock_guard<mutex> lock(mutex_);
+      --busy_workers_;
+    }
+    work_done_.notify_one();
+  }
+}
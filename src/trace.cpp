@@ -0,0 +1,96 @@
+#include "trace.h"
+#include "json.h"
+
+#include <atomic>
+#include <cstdlib>
+#include <fstream>
+
+using namespace std;
+
+namespace Trace {
+
+  Recorder& Recorder::Global() {
+    static Recorder recorder = [] {
+      const char* path = getenv("TRANSPORT_TRACE");
+      return Recorder(path == nullptr ? "" : path);
+    }();
+    return recorder;
+  }
+
+  void Recorder::AddEvent(Event event) {
+    lock_guard<mutex> lock(mutex_);
+    events_.push_back(move(event));
+  }
+
+  void Recorder::Clear() {
+    lock_guard<mutex> lock(mutex_);
+    events_.clear();
+  }
+
+  uint32_t Recorder::GetThreadId() {
+    static atomic<uint32_t> next_thread_id = 0;
+    thread_local const uint32_t thread_id = next_thread_id++;
+    return thread_id;
+  }
+
+  void Recorder::WriteTrace(ostream& output) const {
+    lock_guard<mutex> lock(mutex_);
+    auto to_microseconds = [](Clock::duration duration) {
+      return chrono::duration<double, micro>(duration).count();
+    };
+    // Timestamps are microseconds since the recorder was created, so they need
+    // more than the default six digits.
+    const streamsize output_precision = output.precision(15);
+    Json::Writer writer(output);
+    output.precision(output_precision);
+    writer.BeginObject();
+    writer.Key("displayTimeUnit");
+    writer.Value("ms");
+    writer.Key("traceEvents");
+    writer.BeginArray();
+    for (const Event& event : events_) {
+      writer.BeginObject();
+      writer.Key("name");
+      writer.Value(event.name);
+      writer.Key("cat");
+      writer.Value(event.category);
+      writer.Key("ph");
+      writer.Value("X");
+      writer.Key("ts");
+      writer.Value(to_microseconds(event.start - start_));
+      writer.Key("dur");
+      writer.Value(to_microseconds(event.duration));
+      writer.Key("pid");
+      writer.Value(1);
+      writer.Key("tid");
+      writer.Value(static_cast<int>(event.thread_id));
+      if (!event.args.empty()) {
+        writer.Key("args");
+        writer.BeginObject();
+        for (const auto& [key, value] : event.args) {
+          writer.Key(key);
+          if (holds_alternative<int>(value)) {
+            writer.Value(get<int>(value));
+          } else {
+            writer.Value(get<string>(value));
+          }
+        }
+        writer.EndObject();
+      }
+      writer.EndObject();
+    }
+    writer.EndArray();
+    writer.EndObject();
+    writer.Flush();
+    output << endl;
+  }
+
+  void Recorder::Save() const {
+    if (!IsEnabled()) {
+      return;
+    }
+    ofstream output(path_);
+    WriteTrace(output);
+  }
+
+}